@@ -0,0 +1,122 @@
+/*
+ * Throughput of builder API by thread count: every thread adds COUNT / N
+ * random /32 through own cidrips_local_t, then the builder is finalized.
+ * Only public API of libcidrips is used.
+ *
+ *      bench_builder_threads [THREADS] [COUNT] [LEVEL]
+ *
+ * THREADS is comma separated list of thread counts (default 1,2,4,8), COUNT
+ * is total number of addresses (default 20000000), LEVEL is passed to
+ * cidrips_builder_finalize() (default 2). Addresses are drawn from /4, so
+ * part of them repeats like in real logs.
+ */
+#include "cidrips.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct
+{
+        cidrips_builder_t *builder;
+        uint64_t seed;
+        size_t count;
+        int ok;
+} bench_worker_t;
+
+static double bench_now(void)
+{
+        struct timespec ts;
+        timespec_get(&ts, TIME_UTC);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *bench_worker(void *arg)
+{
+        bench_worker_t *w = arg;
+        cidrips_local_t *local = cidrips_local_new(w->builder);
+        size_t i;
+        w->ok = local != (void *)0;
+        for (i = 0; w->ok && i < w->count; i++)
+        {
+                w->seed ^= w->seed << 13;
+                w->seed ^= w->seed >> 7;
+                w->seed ^= w->seed << 17;
+                w->ok = cidrips_local_add(local, 0x10000000 | (uint32_t)(w->seed & 0x0fffffff), 32);
+        }
+        if (local && !cidrips_local_free(local))
+        {
+                w->ok = 0;
+        }
+        return (void *)0;
+}
+
+/*
+ * One run with thread_count threads, prints ingest and finalize times.
+ */
+static int bench_run(int thread_count, size_t count, int level)
+{
+        cidrips_builder_t *builder = cidrips_builder_new();
+        bench_worker_t workers[256];
+        pthread_t threads[256];
+        cidrips_subnet_t *subnets;
+        size_t subnet_count;
+        double start, ingest;
+        int i, started = 0, ok = builder != (void *)0;
+        start = bench_now();
+        for (i = 0; ok && i < thread_count; i++)
+        {
+                workers[i].builder = builder;
+                workers[i].seed = 88172645463325252ULL + (uint64_t)i * 7919;
+                workers[i].count = count / thread_count;
+                ok = pthread_create(&threads[i], (void *)0, bench_worker, &workers[i]) == 0;
+                started += ok;
+        }
+        for (i = 0; i < started; i++)
+        {
+                pthread_join(threads[i], (void *)0);
+                ok = ok && workers[i].ok;
+        }
+        ingest = bench_now() - start;
+        start = bench_now();
+        if (!ok || !cidrips_builder_finalize(builder, level, 0, &subnets, &subnet_count))
+        {
+                fprintf(stderr, "%d threads: builder failed\n", thread_count);
+                cidrips_builder_free(builder);
+                return 0;
+        }
+        printf("%7d %12.3f %9.2f %12.3f %9zu\n", thread_count, ingest * 1e3, count / ingest / 1e6,
+               (bench_now() - start) * 1e3, subnet_count);
+        free(subnets);
+        cidrips_builder_free(builder);
+        return 1;
+}
+
+int main(int argc, char **argv)
+{
+        const char *list = argc > 1 ? argv[1] : "1,2,4,8";
+        size_t count = argc > 2 ? strtoull(argv[2], (void *)0, 10) : 20000000;
+        int level = argc > 3 ? atoi(argv[3]) : 2;
+        char *end;
+        long n;
+        int ok = 1;
+        if (count < 1 || level < 0 || level > 32)
+        {
+                fprintf(stderr, "usage: bench_builder_threads [THREADS] [COUNT] [LEVEL]\n");
+                return EXIT_FAILURE;
+        }
+        printf("count=%zu, level=%d\n", count, level);
+        printf("threads  ingest (ms)  M addr/s  finalize (ms)  subnets\n");
+        while (ok && *list)
+        {
+                n = strtol(list, &end, 10);
+                if (end == list || n < 1 || n > 256 || (*end && *end != ','))
+                {
+                        fprintf(stderr, "bench_builder_threads: wrong thread list %s\n", list);
+                        return EXIT_FAILURE;
+                }
+                ok = bench_run((int)n, count, level);
+                list = *end ? end + 1 : end;
+        }
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
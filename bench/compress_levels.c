@@ -0,0 +1,201 @@
+/*
+ * Microbenchmark of compress() levels: run boundary kernels and the merge
+ * pass of every level from /31 to /0 on sorted random addresses. Internal
+ * functions are reached by including cidrips.c built without main().
+ *
+ *      bench_compress_levels [COUNT] [GAP] [LEVEL]
+ *
+ * Addresses are COUNT (default 10000000) sorted /32 with random gaps of 1
+ * to 2 * GAP (default 64), aggregated with LEVEL (default 2). Columns are
+ * boundary kernels and the whole compress_level() pass. Every kernel
+ * is checked against scalar one.
+ */
+#include "../cidrips.c"
+
+#define BENCH_REPEAT 5
+
+typedef struct
+{
+        const char *name;
+        compress_bounds_cb *kernel;
+} bench_kernel_t;
+
+static void bench_bounds_scalar(const uint32_t *addr, size_t n, uint32_t mask, uint64_t *bounds)
+{
+        compress_bounds_range(addr, 1, n, mask, bounds);
+}
+
+static const bench_kernel_t bench_kernels[] = {
+    {"scalar", bench_bounds_scalar},
+#if defined(__SSE2__) || defined(_M_X64)
+    {"sse2", compress_bounds_sse2},
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    {"neon", compress_bounds_neon},
+#endif
+#if defined(__GNUC__) && defined(__x86_64__)
+    {"avx2", compress_bounds_avx2},
+#endif
+};
+
+#define BENCH_KERNELS (sizeof(bench_kernels) / sizeof(bench_kernels[0]))
+
+static int bench_supported(const bench_kernel_t *k)
+{
+#if defined(__GNUC__) && defined(__x86_64__)
+        if (k->kernel == compress_bounds_avx2)
+        {
+                __builtin_cpu_init();
+                return __builtin_cpu_supports("avx2");
+        }
+#endif
+        return 1;
+}
+
+static void bench_buf_free(compress_buf_t *b)
+{
+        free(b->addr);
+        free(b->cidr);
+        free(b->count);
+        free(b->bounds);
+}
+
+/*
+ * Arrays of compress() for up to n subnets. Returns 0 if out of memory.
+ */
+static int bench_buf_alloc(compress_buf_t *b, size_t n)
+{
+        b->addr = malloc(n * sizeof(uint32_t));
+        b->cidr = malloc(n * sizeof(uint8_t));
+        b->count = malloc(n * sizeof(uint64_t));
+        b->bounds = malloc(((n + 63) / 64) * sizeof(uint64_t));
+        b->label = 0;
+        if (!b->addr || !b->cidr || !b->count || !b->bounds)
+        {
+                bench_buf_free(b);
+                return 0;
+        }
+        return 1;
+}
+
+static uint64_t bench_rand(uint64_t *x)
+{
+        *x ^= *x << 13;
+        *x ^= *x >> 7;
+        *x ^= *x << 17;
+        return *x;
+}
+
+/*
+ * Best time of BENCH_REPEAT runs of kernel on n keys, bounds are left for
+ * check.
+ */
+static double bench_bounds(const bench_kernel_t *k, const uint32_t *addr, size_t n, uint32_t mask, uint64_t *bounds)
+{
+        double best = 1e9, t;
+        int r;
+        for (r = 0; r < BENCH_REPEAT; r++)
+        {
+                t = time_now();
+                memset(bounds, 0, ((n + 63) / 64) * sizeof(uint64_t));
+                bounds[0] = 1;
+                k->kernel(addr, n, mask, bounds);
+                t = time_now() - t;
+                best = t < best ? t : best;
+        }
+        return best;
+}
+
+int main(int argc, char **argv)
+{
+        size_t count = argc > 1 ? strtoull(argv[1], (void *)0, 10) : 10000000;
+        uint32_t gap = argc > 2 ? (uint32_t)strtoul(argv[2], (void *)0, 10) : 64;
+        int level = argc > 3 ? atoi(argv[3]) : 2;
+        compress_buf_t b, work;
+        uint64_t *check, x = 88172645463325252ULL;
+        uint32_t addr = 0, mask;
+        size_t j, n, words;
+        double t, m, total[BENCH_KERNELS + 1] = {0};
+        unsigned int k;
+        int i, ok = 1;
+        if (count < 2 || gap < 1 || level < 0 || level > 32 || !bench_buf_alloc(&b, count) ||
+            !bench_buf_alloc(&work, count))
+        {
+                fprintf(stderr, "usage: bench_compress_levels [COUNT] [GAP] [LEVEL]\n");
+                return EXIT_FAILURE;
+        }
+        words = (count + 63) / 64;
+        check = malloc(words * sizeof(uint64_t));
+        if (!check)
+        {
+                return EXIT_FAILURE;
+        }
+        for (n = 0; n < count; n++)
+        {
+                b.addr[n] = addr;
+                b.cidr[n] = 32;
+                b.count[n] = 1;
+                if (addr > UINT32_MAX - 2 * gap)
+                {
+                        n++;
+                        break;
+                }
+                addr += 1 + (uint32_t)(bench_rand(&x) % (2 * gap));
+        }
+        printf("count=%zu, gap=%u, level=%d, best of %d runs, ms\n", n, gap, level, BENCH_REPEAT);
+        printf("level  subnets");
+        for (k = 0; k < BENCH_KERNELS; k++)
+        {
+                printf(" %9s", bench_kernels[k].name);
+        }
+        printf("      pass\n");
+        for (i = 31; i >= 0; i--)
+        {
+                mask = i ? ~0U << (32 - i) : 0;
+                printf("/%-4d %9zu", i, n);
+                for (k = 0; k < BENCH_KERNELS; k++)
+                {
+                        if (!bench_supported(&bench_kernels[k]))
+                        {
+                                printf(" %9s", "-");
+                                continue;
+                        }
+                        t = bench_bounds(&bench_kernels[k], b.addr, n, mask, k ? b.bounds : check);
+                        total[k] += t;
+                        printf(" %9.3f", t * 1e3);
+                        if (k && memcmp(check, b.bounds, ((n + 63) / 64) * sizeof(uint64_t)) != 0)
+                        {
+                                fprintf(stderr, "%s: boundaries differ from scalar at /%d\n", bench_kernels[k].name,
+                                        i);
+                                ok = 0;
+                        }
+                }
+                // whole level as compress() runs it, on copy because level compacts arrays in place
+                t = 1e9;
+                for (k = 0; k < BENCH_REPEAT; k++)
+                {
+                        memcpy(work.addr, b.addr, n * sizeof(uint32_t));
+                        memcpy(work.cidr, b.cidr, n * sizeof(uint8_t));
+                        memcpy(work.count, b.count, n * sizeof(uint64_t));
+                        m = time_now();
+                        j = compress_level(&work, n, i, level, (void *)0, compress_bounds_kernel());
+                        m = time_now() - m;
+                        t = m < t ? m : t;
+                }
+                total[BENCH_KERNELS] += t;
+                printf(" %9.3f\n", t * 1e3);
+                memcpy(b.addr, work.addr, j * sizeof(uint32_t));
+                memcpy(b.cidr, work.cidr, j * sizeof(uint8_t));
+                memcpy(b.count, work.count, j * sizeof(uint64_t));
+                n = j;
+        }
+        printf("total           ");
+        for (k = 0; k <= BENCH_KERNELS; k++)
+        {
+                printf(" %9.3f", total[k] * 1e3);
+        }
+        printf("\n");
+        bench_buf_free(&b);
+        bench_buf_free(&work);
+        free(check);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,134 @@
+/*
+ * Lookup speed of include/cidrips_lpm.h on table written by cidrips
+ * --output-format=lpm-table. Only the header-only reader is used.
+ *
+ *      bench_lpm_lookup TABLE [LOOKUPS]
+ *
+ * LOOKUPS (default 20000000) addresses are looked up twice: random ones
+ * (mostly misses on small tables) and ones inside ranges of the table
+ * (hits). Addresses are generated before timing.
+ */
+#include "cidrips_lpm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_REPEAT 5
+
+static double bench_now(void)
+{
+        struct timespec ts;
+        timespec_get(&ts, TIME_UTC);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t bench_rand(uint64_t *x)
+{
+        *x ^= *x << 13;
+        *x ^= *x >> 7;
+        *x ^= *x << 17;
+        return *x;
+}
+
+/*
+ * Read whole file into buffer aligned for the table.
+ */
+static void *bench_load(const char *name, size_t *size)
+{
+        FILE *f = fopen(name, "rb");
+        uint64_t *data;
+        long n;
+        if (!f)
+        {
+                return (void *)0;
+        }
+        if (fseek(f, 0, SEEK_END) != 0 || (n = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0)
+        {
+                fclose(f);
+                return (void *)0;
+        }
+        data = malloc((size_t)n + 8);
+        if (data && fread(data, 1, (size_t)n, f) != (size_t)n)
+        {
+                free(data);
+                data = (void *)0;
+        }
+        fclose(f);
+        *size = (size_t)n;
+        return data;
+}
+
+/*
+ * Best time of BENCH_REPEAT passes over addr, prints ns per lookup and
+ * share of hits.
+ */
+static void bench_lookup(const char *name, const cidrips_lpm_t *lpm, const uint32_t *addr, size_t n)
+{
+        double best = 1e9, t;
+        uint64_t sum = 0, hits = 0;
+        uint32_t value;
+        size_t i;
+        int r;
+        for (r = 0; r < BENCH_REPEAT; r++)
+        {
+                hits = 0;
+                t = bench_now();
+                for (i = 0; i < n; i++)
+                {
+                        value = 0;
+                        hits += cidrips_lpm_lookup(lpm, addr[i], &value);
+                        sum += value;
+                }
+                t = bench_now() - t;
+                best = t < best ? t : best;
+        }
+        // sum keeps lookups from being optimized out
+        printf("%-8s %10.2f %8.1f%% %20llu\n", name, best * 1e9 / n, 100.0 * hits / n, (unsigned long long)sum);
+}
+
+int main(int argc, char **argv)
+{
+        cidrips_lpm_t lpm;
+        uint64_t x = 88172645463325252ULL;
+        uint32_t *addr, k;
+        size_t size, count, i;
+        void *data;
+        if (argc < 2)
+        {
+                fprintf(stderr, "usage: bench_lpm_lookup TABLE [LOOKUPS]\n");
+                return EXIT_FAILURE;
+        }
+        count = argc > 2 ? strtoull(argv[2], (void *)0, 10) : 20000000;
+        data = bench_load(argv[1], &size);
+        if (!data || !cidrips_lpm_open(&lpm, data, size))
+        {
+                fprintf(stderr, "%s: cannot open table\n", argv[1]);
+                return EXIT_FAILURE;
+        }
+        addr = malloc(count * sizeof(uint32_t) + 1);
+        if (!addr || count < 1)
+        {
+                return EXIT_FAILURE;
+        }
+        printf("%s: %u ranges, %u labels, %zu lookups, best of %d runs\n", argv[1], lpm.header->range_count,
+               lpm.header->label_count, count, BENCH_REPEAT);
+        printf("lookups  ns/lookup     hits                  sum\n");
+        for (i = 0; i < count; i++)
+        {
+                addr[i] = (uint32_t)bench_rand(&x);
+        }
+        bench_lookup("random", &lpm, addr, count);
+        if (lpm.header->range_count > 0)
+        {
+                for (i = 0; i < count; i++)
+                {
+                        k = (uint32_t)(bench_rand(&x) % lpm.header->range_count);
+                        addr[i] = lpm.first[k] +
+                                  (uint32_t)(bench_rand(&x) % ((uint64_t)lpm.last[k] - lpm.first[k] + 1));
+                }
+                bench_lookup("covered", &lpm, addr, count);
+        }
+        free(addr);
+        free(data);
+        return EXIT_SUCCESS;
+}
@@ -1,1110 +1,7304 @@
-#include "version.h"
-#include <errno.h>
-#include <stdint.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-typedef struct
-{
-        unsigned int addr;
-        int cidr;
-} addr_t;
-
-typedef struct addr_list
-{
-        addr_t addr;
-        size_t count;
-        struct addr_list *next, *prev;
-} addr_list_t;
-
-addr_list_t *list_item_alloc()
-{
-        addr_list_t *p = malloc(sizeof(addr_list_t));
-        if (p)
-        {
-                p->count = 0;
-                p->next = (void *)0;
-                p->prev = (void *)0;
-        }
-        return p;
-}
-
-static inline int64_t addr_raw_mask(addr_t *addr, int cidr)
-{
-        return addr->addr & (~0UL << (32 - cidr));
-}
-
-static inline int min(int a, int b)
-{
-        return a > b ? b : a;
-}
-
-static int addr_compare(addr_t *addr0, addr_t *addr1)
-{
-        int cidr;
-        int64_t cmp;
-        cidr = min(addr0->cidr, addr1->cidr);
-        cmp = addr_raw_mask(addr0, cidr) - addr_raw_mask(addr1, cidr);
-        if (cmp > 0)
-        {
-                return 1;
-        }
-        else if (cmp < 0)
-        {
-                return -1;
-        }
-        else if (addr0->cidr > addr1->cidr)
-        {
-                return -1;
-        }
-        else if (addr0->cidr < addr1->cidr)
-        {
-                return 1;
-        }
-        return 0;
-}
-
-static void list_insert_before(addr_list_t **head, addr_list_t **tail, addr_list_t *before_this, addr_list_t *item)
-{
-        if (before_this)
-        {
-                item->next = before_this;
-                if (before_this->prev)
-                {
-                        before_this->prev->next = item;
-                }
-                else
-                {
-                        *head = item;
-                }
-                item->prev = before_this->prev;
-                before_this->prev = item;
-        }
-        else
-        {
-                if (*tail)
-                {
-                        (*tail)->next = item;
-                        item->prev = *tail;
-                        *tail = item;
-                }
-                else
-                {
-                        *head = item;
-                        *tail = item;
-                }
-        }
-}
-
-static int list_push_sorted(addr_list_t **head, addr_list_t **tail, addr_list_t *item)
-{
-        addr_list_t *p = *head;
-        int rc;
-        while (p)
-        {
-                rc = addr_compare(&(p->addr), &(item->addr));
-                if (rc == 0)
-                {
-                        return 0;
-                }
-                else if (rc > 0)
-                {
-                        break;
-                }
-                p = p->next;
-        }
-        list_insert_before(head, tail, p, item);
-        return 1;
-}
-
-void list_remove(addr_list_t **head, addr_list_t **tail, addr_list_t *item)
-{
-        if (item->prev)
-        {
-                item->prev->next = item->next;
-        }
-        else
-        {
-                *head = item->next;
-        }
-        if (item->next)
-        {
-                item->next->prev = item->prev;
-        }
-        else
-        {
-                *tail = item->next;
-        }
-        item->next = (void *)0;
-        item->prev = (void *)0;
-}
-
-void list_free(addr_list_t **head, addr_list_t **tail)
-{
-        addr_list_t *p = *head, *t;
-        while (p)
-        {
-                t = p->next;
-                list_remove(head, tail, p);
-                free(p);
-                p = t;
-        }
-}
-
-int list_copy(addr_list_t *head, addr_list_t *tail, addr_list_t **thead, addr_list_t **ttail)
-{
-        addr_list_t *p0 = head;
-        addr_list_t *item;
-        while (p0)
-        {
-                item = list_item_alloc();
-                if (!item)
-                {
-                        return 0;
-                }
-                memmove(item, p0, sizeof(addr_list_t));
-                item->prev = (void *)0;
-                item->next = (void *)0;
-                if (*thead)
-                {
-                        item->prev = *ttail;
-                        (*ttail)->next = item;
-                        *ttail = item;
-                }
-                else
-                {
-                        *thead = item;
-                        *ttail = item;
-                }
-                p0 = p0->next;
-        }
-        return 1;
-}
-
-static int addr_parse_v4(char *data, size_t size, addr_t *addr)
-{
-        int rc, n;
-        unsigned char a, b, c, d, cidr;
-        rc = sscanf(data, "%hhu.%hhu.%hhu.%hhu%n", &a, &b, &c, &d, &n);
-        if (rc < 4)
-        {
-                return 0;
-        }
-        data += n;
-        size -= n;
-        addr->cidr = 32;
-        if (size > 0)
-        {
-                rc = sscanf(data, "/%hhu", &cidr);
-                if (rc < 1 || cidr > 32)
-                {
-                        return 0;
-                }
-                addr->cidr = cidr;
-        }
-        addr->addr = (a << 24) | (b << 16) | (c << 8) | d;
-        return 1;
-}
-
-static void addr_print_v4(FILE *o, addr_t *addr)
-{
-        fprintf(o, "%hhu.%hhu.%hhu.%hhu", addr->addr >> 24, (addr->addr >> 16) & 0xff, (addr->addr >> 8) & 0xff,
-                addr->addr & 0xff);
-        if (addr->cidr != 32)
-        {
-                fprintf(o, "/%hhu", addr->cidr);
-        }
-}
-
-static inline size_t addr_v4_weight(int cidr)
-{
-        return 1ULL << (32 - cidr);
-}
-
-static size_t addr_start_col = 1, addr_start_row = 1, parse_col = 1, parse_row = 1;
-static int parse_char;
-
-enum
-{
-        PARSE_OK = 0,
-        PARSE_EADDR = 1,
-        PARSE_ESYMBOL = 2,
-        PARSE_EMEM = 3,
-        PARSE_EIO = 4
-};
-
-static int parse_input(FILE *o, addr_list_t **head, addr_list_t **tail)
-{
-        char b[64] = {0}, *p = b;
-        char c;
-        addr_list_t *item = list_item_alloc();
-        if (!item)
-        {
-                return PARSE_EMEM;
-        }
-        parse_col = 1;
-        parse_row = 1;
-        int new_row_use_r = 0;
-        while (1)
-        {
-                c = getc(o);
-                parse_char = c;
-                switch (c)
-                {
-                case '0':
-                case '1':
-                case '2':
-                case '3':
-                case '4':
-                case '5':
-                case '6':
-                case '7':
-                case '8':
-                case '9':
-                case '.':
-                case '/':
-                        if (p - b == 0)
-                        {
-                                addr_start_col = parse_col;
-                                addr_start_row = parse_row;
-                        }
-                        *p = c;
-                        p++;
-                        if (b - p > 63)
-                        {
-                                return PARSE_EADDR;
-                        }
-                        break;
-                case ' ':
-                case '\t':
-                case '\r':
-                case '\n':
-                case ',':
-                case EOF:
-                        if (c == '\r')
-                        {
-                                if (new_row_use_r)
-                                {
-                                        return PARSE_ESYMBOL;
-                                }
-                                new_row_use_r = 1;
-                                parse_col = 1;
-                                parse_row++;
-                        }
-                        else if (c == '\n')
-                        {
-                                if (new_row_use_r)
-                                {
-                                        new_row_use_r = 0;
-                                }
-                                else
-                                {
-                                        parse_row++;
-                                }
-                        }
-                        if (p != b)
-                        {
-                                *p = '\0';
-                                if (!addr_parse_v4(b, p - b, &(item->addr)))
-                                {
-                                        return PARSE_EADDR;
-                                }
-                                else
-                                {
-                                        item->count = addr_v4_weight(item->addr.cidr);
-                                        if (list_push_sorted(head, tail, item))
-                                        {
-                                                item = list_item_alloc();
-                                                if (!item)
-                                                {
-                                                        return PARSE_EMEM;
-                                                }
-                                        }
-                                        else
-                                        {
-                                                // function detected copy of
-                                                // this address. Skip
-                                        }
-                                }
-                                p = b;
-                        }
-                        if (c == EOF)
-                        {
-                                if (!feof(o))
-                                {
-                                        return PARSE_EIO;
-                                }
-                                return PARSE_OK;
-                        }
-                        break;
-                default:
-                        return PARSE_ESYMBOL;
-                }
-                parse_col++;
-        }
-        return PARSE_OK;
-}
-
-typedef struct
-{
-        char input[256];
-        char output[256];
-        char prefix[256];
-        char postfix[256];
-        int mode;
-        int count;
-        int level;
-        int help;
-        int overwrite;
-        int no_stats;
-        int append;
-        int cancel;
-} args_t;
-
-void cli_help(FILE *o)
-{
-        // clang-format off
-        fprintf(o,
-                "cidrips v%d.%d.%d.rev%s\nUtlity for compress any IP list groupping "
-                "by CIDR mask.\n\n",
-                cidrips_version_major, cidrips_version_minor, cidrips_version_patch,
-                cidrips_git_rev);
-        fprintf(o, "Usage:\n");
-        fprintf(o, "\tcidrips -i[FILE]\n");
-        fprintf(o, "\tcidrips -i[FILE] -o[FILE]\n");
-        fprintf(o, "\tcidrips -mlevel [-l[level]] -i[FILE] -o[FILE]\n");
-        fprintf(o, "\tcidrips -mcount [-c[count]] -i[FILE] -o[FILE]\n");
-        fprintf(o, "\tcidrips -i[FILE] -p[PREFIX] -P[POSTFIX]\n\n");
-        fprintf(o, "Arguments:\n");
-        fprintf(o, "\t-i,--input    [FILE]           Path to file with input ips. (Use \n");
-        fprintf(o, "\t                               --input - for stdin)\n");
-        fprintf(o, "\t-o,--out      [FILE]           Path to file with output subnets. (Use \n");
-        fprintf(o, "\t                               --input - for stdin)\n");
-        fprintf(o, "\t-m,--mode     [level|count]    Use this method for generate \n");
-        fprintf(o, "\t                               subnets: level >=0, count - maximum count\n");
-        fprintf(o, "\t                               of result subnets.\n");
-        fprintf(o, "\t                               [Default: level]\n");
-        fprintf(o, "\t-l,--level    [LEVEL]          Comression level.  [Default: 0]\n");
-        fprintf(o, "\t-c,--count    [COUNT]          Maxmimum count of result subnets.\n");
-        fprintf(o, "\t                               [Default: not specifie]\n");
-        fprintf(o, "\t-p,--prefix   [prefix]         Prefix for generated subnet in output.\n");
-        fprintf(o, "\t                               [Default: \"\"]\n");
-        fprintf(o, "\t-P,--postfix  [postfix]        Postfix for generated subnet in output.\n");
-        fprintf(o, "\t                               [Default: \"\\n\"\n");
-        fprintf(o, "\t-O, --overwrite                Overwrite output file if not empty\n");
-        fprintf(o, "\t-A, --append                   Append into output file.\n");
-        fprintf(o, "\t-C, --cancel                   Cancel if output file is not empty.\n");
-        fprintf(o, "\t    --no-stats                 No print any statistics\n");
-        // clang-format on
-}
-
-#define MODE_UNKNOWN 0
-#define MODE_LEVEL 1
-#define MODE_COUNT 2
-
-#define ARG_OPTIONAL 0x1
-#define ARG_NO_VALUE 0x2
-
-typedef int(arg_handler_cb)(const char *arg_val, args_t *cli_args);
-
-static int arg_input(const char *arg_val, args_t *cli_args)
-{
-        if (arg_val == (void *)0)
-        {
-                return 0;
-        }
-        if (strlen(arg_val) > 255)
-        {
-                fprintf(stderr, "--input: argument too long.\n");
-                return 0;
-        }
-        strcpy(cli_args->input, arg_val);
-        return 1;
-}
-
-static int arg_output(const char *arg_val, args_t *cli_args)
-{
-        if (arg_val == (void *)0)
-        {
-                cli_args->output[0] = 0;
-        }
-        else if (strlen(arg_val) > 255)
-        {
-                fprintf(stderr, "--output: argument too long.\n");
-                return 0;
-        }
-        else
-        {
-                strcpy(cli_args->output, arg_val);
-                return 1;
-        }
-        return 1;
-}
-
-static int arg_mode(const char *arg_val, args_t *cli_args)
-{
-        if (arg_val == (void *)0)
-        {
-                cli_args->mode = MODE_LEVEL;
-        }
-        else if (strcmp(arg_val, "level") == 0)
-        {
-                cli_args->mode = MODE_LEVEL;
-        }
-        else if (strcmp(arg_val, "count") == 0)
-        {
-                cli_args->mode = MODE_COUNT;
-        }
-        else
-        {
-                fprintf(stderr,
-                        "--mode: invalid value, support only level or count. "
-                        "got: \"%s\"\n",
-                        arg_val);
-                return 0;
-        }
-        return 1;
-}
-
-static int arg_level(const char *arg_val, args_t *cli_args)
-{
-        if (cli_args->mode != MODE_UNKNOWN && cli_args->mode != MODE_LEVEL)
-        {
-                fprintf(stderr, "--level: Unexpected for this mode.\n");
-                return 0;
-        }
-        if (arg_val == (void *)0)
-        {
-                cli_args->level = 0;
-        }
-        else if (arg_val[0] >= '0' && arg_val[0] <= '9')
-        {
-                cli_args->level = atoi(arg_val);
-        }
-        else
-        {
-                fprintf(stderr, "--level: invalid value, non-negative numbers.\n");
-                return 0;
-        }
-        return 1;
-}
-
-static int arg_count(const char *arg_val, args_t *cli_args)
-{
-        if (cli_args->mode != MODE_UNKNOWN && cli_args->mode == MODE_LEVEL)
-        {
-                fprintf(stderr, "--count: Unexpected for this mode.\n");
-                return 0;
-        }
-        if (arg_val == (void *)0)
-        {
-                cli_args->count = 1;
-        }
-        else if (arg_val[0] > '0' && arg_val[0] <= '9')
-        {
-                cli_args->count = atoi(arg_val);
-        }
-        else
-        {
-                fprintf(stderr, "--count: invalid value, positive numbers. got %s\n", arg_val);
-                return 0;
-        }
-        return 1;
-}
-
-void strcpy_escaped(char *s0, const char *s1)
-{
-        int escape = 0;
-        char *p = (char *)s1;
-        char *out = s0;
-        while (*p)
-        {
-                if (!escape)
-                {
-                        if (*p == '\\')
-                        {
-                                escape = 1;
-                        }
-                        else
-                        {
-                                *out = *p;
-                                out++;
-                        }
-                }
-                else
-                {
-                        escape = 0;
-                        if (*p == 'n')
-                        {
-                                *out = '\n';
-                        }
-                        else if (*p == 'r')
-                        {
-                                *out = '\r';
-                        }
-                        else if (*p == 't')
-                        {
-                                *out = '\t';
-                        }
-                        else
-                        {
-                                *out = '\\';
-                                out++;
-                                *out = *p;
-                        }
-                        out++;
-                }
-                p++;
-        }
-        *out = '\0';
-}
-
-static int arg_prefix(const char *arg_val, args_t *cli_args)
-{
-        if (!arg_val)
-        {
-                cli_args->prefix[0] = '\0';
-                return 1;
-        }
-
-        if (strlen(arg_val) > 255)
-        {
-                fprintf(stderr, "--prefix: argument too long.\n");
-                return 0;
-        }
-        strcpy_escaped(cli_args->prefix, arg_val);
-        return 1;
-}
-
-static int arg_postfix(const char *arg_val, args_t *cli_args)
-{
-        if (!arg_val)
-        {
-                cli_args->prefix[0] = '\n';
-                cli_args->prefix[1] = '\0';
-                return 1;
-        }
-
-        if (strlen(arg_val) > 255)
-        {
-                fprintf(stderr, "--postfix: argument too long.\n");
-                return 0;
-        }
-        strcpy_escaped(cli_args->postfix, arg_val);
-        return 1;
-}
-
-static int arg_overwrite(const char *arg_val, args_t *cli_args)
-{
-        cli_args->overwrite = 1;
-        return 1;
-}
-
-static int arg_append(const char *arg_val, args_t *cli_args)
-{
-        cli_args->append = 1;
-        return 1;
-}
-
-static int arg_cancel(const char *arg_val, args_t *cli_args)
-{
-        cli_args->cancel = 1;
-        return 1;
-}
-
-static int arg_no_stats(const char *arg_val, args_t *cli_args)
-{
-        cli_args->no_stats = 1;
-        return 1;
-}
-
-static int arg_help(const char *arg_val, args_t *cli_args)
-{
-        cli_args->help = 1;
-        return 1;
-}
-
-static struct argtab
-{
-        int arg_index;
-        const char arg_short;
-        const char *arg_long;
-        int arg_flags;
-        const char *arg_default;
-        const char *arg_description;
-        arg_handler_cb *arg_handler;
-} _argtab[] = {
-    // clang-format off
-    {0, 'h', "help", ARG_OPTIONAL | ARG_NO_VALUE, 0, "Show help.", arg_help},
-    {1, 'i', "input", 0, 0, "Path to input file with ip addresses.", arg_input},
-    {2, 'o', "output", ARG_OPTIONAL, 0, "Path to output file.", arg_output},
-    {3, 'm', "mode", ARG_OPTIONAL, "level", "Compression mode.", arg_mode},
-    {4, 'l', "level", ARG_OPTIONAL, "0", "Compress level. Required for --mode=level.", arg_level},
-    {5, 'c', "count", ARG_OPTIONAL, 0, "Max count of output. Required for --mode=count.", arg_count},
-    {6, 'p', "prefix", ARG_OPTIONAL, "", "Prefix for ouput ip address.", arg_prefix},
-    {7, 'P', "postfix", ARG_OPTIONAL, "\n", "Postfix for ouput ip address", arg_postfix},
-    {8, 'O', "overwrite", ARG_OPTIONAL | ARG_NO_VALUE, 0, "Owerwrite ouput is not empty.", arg_overwrite},
-    {9, 's', "no-stats", ARG_OPTIONAL | ARG_NO_VALUE, 0, "Dont print any statistic info.", arg_no_stats},
-    {10, 'A', "append", ARG_OPTIONAL | ARG_NO_VALUE, 0, "Append file if not empty", arg_append},
-    {11, 'C', "cancel", ARG_OPTIONAL | ARG_NO_VALUE, 0, "Cancel if output file is not empty.", arg_cancel}};
-// clang-format on
-static int _argtab_size = 12;
-
-static int cli_arg_val_contain(char arg_short, const char *arg_long, const char *argv)
-{
-        // clang-format off
-  if (argv[0] == '-' && argv[1] == arg_short && strlen(argv) == 2)
-    return 0;
-  if (argv[0] == '-' && argv[1] == '-' && strstr(argv, arg_long) == argv + 2 &&
-      strlen(argv) == strlen(arg_long) + 2 && argv[strlen(arg_long) + 2] != '=')
-    return 0;
-        // clang-format on
-        return 1;
-}
-
-static char *cli_arg_val(char arg_short, const char *arg_long, const char *argv)
-{
-        char *p, *pp;
-        if (argv[0] == '-' && argv[1] == arg_short)
-                p = (char *)argv + 2;
-        if (argv[0] == '-' && argv[1] == '-' && strstr(argv, arg_long) == argv + 2)
-                p = (char *)argv + strlen(arg_long) + 2;
-        if (*p == '\0')
-        {
-                return (char *)0;
-        }
-        if (*p == '=')
-        {
-                p++;
-        }
-        if (*p == '"')
-        {
-                p++;
-                pp = strchr(p, '"');
-                if (pp)
-                {
-                        *pp = 0;
-                }
-        }
-        if (*p == '\0')
-        {
-                return (void *)0;
-        }
-        return p;
-}
-
-struct argtab *find_arg(const char *argv)
-{
-        int i;
-        for (i = 0; i < _argtab_size; i++)
-        {
-                if (argv[0] == '-' && argv[1] == _argtab[i].arg_short)
-                        return &_argtab[i];
-                if (argv[0] == '-' && strstr(argv, _argtab[i].arg_long) == argv + 2)
-                        return &_argtab[i];
-        }
-        return (void *)0;
-}
-
-int cli_parse(int argc, const char **argv, args_t *args)
-{
-        int i, rc;
-        struct argtab *argtab;
-        int arg_passed[64] = {0};
-        for (i = 1; i < argc; i++)
-        {
-                argtab = find_arg(argv[i]);
-                if (argtab)
-                {
-                        arg_passed[argtab->arg_index] = 1;
-                        if (cli_arg_val_contain(argtab->arg_short, argtab->arg_long, argv[i]))
-                        {
-                                if (argtab->arg_flags & ARG_NO_VALUE)
-                                {
-                                        fprintf(stderr, "--%s: Unexpected value.\n", argtab->arg_long);
-                                        return 0;
-                                }
-                                else
-                                {
-                                        rc = argtab->arg_handler(
-                                            cli_arg_val(argtab->arg_short, argtab->arg_long, argv[i]), args);
-                                        if (!rc)
-                                        {
-                                                return 0;
-                                        }
-                                }
-                        }
-                        else
-                        {
-                                if (i == argc - 1)
-                                {
-                                        if (argtab->arg_flags & ARG_NO_VALUE)
-                                        {
-                                                rc = argtab->arg_handler(argv[i], args);
-                                                if (!rc)
-                                                {
-                                                        return 0;
-                                                }
-                                        }
-                                        else
-                                        {
-                                                fprintf(stderr,
-                                                        "--%s: Expected "
-                                                        "argument value.\n",
-                                                        argtab->arg_long);
-                                                return 0;
-                                        }
-                                }
-                                else
-                                {
-                                        if (argtab->arg_flags & ARG_NO_VALUE)
-                                        {
-                                                rc = argtab->arg_handler(argv[i], args);
-                                                if (!rc)
-                                                {
-                                                        return 0;
-                                                }
-                                        }
-                                        else
-                                        {
-                                                i++;
-                                                rc = argtab->arg_handler(argv[i], args);
-                                                if (!rc)
-                                                {
-                                                        return 0;
-                                                }
-                                        }
-                                }
-                        }
-                        if (argtab->arg_short == 'h')
-                        {
-                                return 1;
-                        }
-                }
-                else
-                {
-                        fprintf(stderr, "%s: Unknown argument\n", argv[i]);
-                        return 0;
-                }
-        }
-
-        for (i = 0; i < _argtab_size; i++)
-        {
-                if (arg_passed[i] == 0 && !(_argtab[i].arg_flags & ARG_OPTIONAL))
-                {
-                        fprintf(stderr, "--%s: required.\n", _argtab[i].arg_long);
-                        return 0;
-                }
-        }
-        return 1;
-}
-
-#define REASON_REWRITE 0
-#define REASON_APPEND 1
-#define REASON_STDOUT 2
-#define REASON_CANCEL 3
-#define REASON_IO_ERROR 4
-
-static int ask_output_file_reason(char *file)
-{
-        int rc;
-        while (1)
-        {
-                rc = printf("File %s is not empty. Rewrite? [y[es]/n[o]/a[ppend]] ", file);
-                if (rc == -1)
-                {
-                        return REASON_IO_ERROR;
-                }
-                rc = getc(stdin);
-                if (rc == EOF)
-                {
-                        return REASON_IO_ERROR;
-                }
-                if (rc == 'y')
-                {
-                        return REASON_REWRITE;
-                }
-                else if (rc == 'n')
-                {
-                        return REASON_CANCEL;
-                }
-                else if (rc == 'a')
-                {
-                        return REASON_APPEND;
-                }
-                else
-                {
-                        // nothing to do invalid input
-                }
-        }
-        return REASON_CANCEL;
-}
-
-static struct compress_stats
-{
-        size_t coverage;
-        size_t source_count;
-} compress_stats;
-
-static int compress(addr_list_t **head, addr_list_t **tail, int level)
-{
-        addr_list_t *p, *ph, *pt, *pnext;
-        size_t sum = 0, ips_count = 0;
-        int i;
-        int count;
-        for (i = 31; i >= 0; i--)
-        {
-                p = *head;
-                count = 0;
-                compress_stats.coverage = 0;
-                compress_stats.source_count = 0;
-                while (p)
-                {
-                        ph = p->next;
-                        pt = p->next;
-                        sum = p->count;
-                        ips_count = 0;
-                        while (pt)
-                        {
-                                if (addr_raw_mask(&(p->addr), i) != addr_raw_mask(&pt->addr, i))
-                                {
-                                        break;
-                                }
-                                sum += pt->count;
-                                ips_count++;
-                                pt = pt->next;
-                        }
-                        if (ips_count > 0)
-                        {
-                                if (sum >= (addr_v4_weight(i) >> level))
-                                {
-                                        p->count = sum;
-                                        p->addr.cidr = i;
-                                        p->addr.addr = (uint32_t)addr_raw_mask(&(p->addr), i);
-                                        do
-                                        {
-                                                pnext = ph->next;
-                                                list_remove(head, tail, ph);
-                                                ph = pnext;
-                                        } while (ph != pt);
-                                }
-                        }
-                        compress_stats.coverage += addr_v4_weight(p->addr.cidr);
-                        compress_stats.source_count += p->count;
-                        count++;
-                        p = p->next;
-                }
-        }
-        return count;
-}
-
-int main(int argc, const char **argv)
-{
-        FILE *o;
-        int rc;
-        args_t args = {0};
-        args.postfix[0] = '\n';
-        args.postfix[1] = '\0';
-        rc = cli_parse(argc, argv, &args);
-        if (!rc)
-        {
-                return EXIT_FAILURE;
-        }
-
-        if (args.help)
-        {
-                cli_help(stdout);
-                return EXIT_SUCCESS;
-        }
-
-        if (strcmp(args.input, "-") == 0)
-        {
-                o = stdin;
-        }
-        else
-        {
-                o = fopen(args.input, "r");
-                if (!o)
-                {
-                        fprintf(stderr, "Cannot open file: %s %s\n", args.input, strerror(errno));
-                        return EXIT_FAILURE;
-                }
-        }
-
-        addr_list_t *head = (void *)0, *tail = (void *)0;
-        rc = parse_input(o, &head, &tail);
-        if (rc == PARSE_EADDR)
-        {
-                fprintf(stderr, "Invalid address at %ld:%ld.\n", addr_start_row, addr_start_col);
-                return EXIT_FAILURE;
-        }
-        else if (rc == PARSE_EIO)
-        {
-                list_free(&head, &tail);
-                fprintf(stderr, "I/O error: %s.\n", strerror(errno));
-                return EXIT_FAILURE;
-        }
-        else if (rc == PARSE_EMEM)
-        {
-                list_free(&head, &tail);
-                fprintf(stderr, "Cannot allocate memory.\n");
-                return EXIT_FAILURE;
-        }
-        else if (rc == PARSE_ESYMBOL)
-        {
-                list_free(&head, &tail);
-                fprintf(stderr, "Unexpected symbol \"%c\" at %ld:%ld.\n", parse_char, parse_row, parse_row);
-                return EXIT_FAILURE;
-        }
-
-        int i, count;
-        addr_list_t *thead = (void *)0, *ttail = (void *)0;
-
-        if (args.mode == MODE_LEVEL)
-        {
-                count = compress(&head, &tail, args.level);
-        }
-        else
-        {
-                for (i = 0; i <= 32; i++)
-                {
-                        if (!list_copy(head, tail, &thead, &ttail))
-                        {
-                                fprintf(stderr, "Memory allocation error.\n");
-                                return EXIT_FAILURE;
-                        }
-                        count = compress(&thead, &ttail, i);
-                        if (count <= args.count)
-                        {
-                                list_free(&head, &tail);
-                                head = thead;
-                                tail = ttail;
-                                break;
-                        }
-                        list_free(&thead, &ttail);
-                }
-        }
-
-        if (!args.no_stats)
-        {
-                printf("coverage=%ld, source=%ld, falsely_covered=%lf%%; "
-                       "result=%d, "
-                       "compress=%lf%%\n",
-                       compress_stats.coverage, compress_stats.source_count,
-                       100.00f - ((double)compress_stats.source_count / compress_stats.coverage * 100.00f), count,
-                       100.00f - ((double)count / compress_stats.source_count * 100.00f));
-        }
-
-        int output_file_reason;
-
-        if (strcmp(args.output, "-") == 0)
-        {
-                output_file_reason = REASON_STDOUT;
-        }
-        else
-        {
-                o = fopen(args.output, "r");
-                if (o)
-                {
-                        fseek(o, 0, SEEK_END);
-                        if (ftell(o) > 0)
-                        {
-                                if (strcmp(args.input, "-") == 0)
-                                {
-                                        if (args.overwrite)
-                                        {
-                                                output_file_reason = REASON_REWRITE;
-                                        }
-                                        else if (args.append)
-                                        {
-                                                output_file_reason = REASON_APPEND;
-                                        }
-                                        else
-                                        {
-                                                fprintf(stderr, "Output file is not "
-                                                                "empty. Cancelled.\n");
-                                                output_file_reason = REASON_CANCEL;
-                                        }
-                                }
-                                else
-                                {
-                                        if (args.overwrite)
-                                        {
-                                                output_file_reason = REASON_REWRITE;
-                                        }
-                                        else if (args.append)
-                                        {
-                                                output_file_reason = REASON_APPEND;
-                                        }
-                                        else if (args.cancel)
-                                        {
-                                                output_file_reason = REASON_CANCEL;
-                                        }
-                                        else
-                                        {
-                                                output_file_reason = ask_output_file_reason(args.output);
-                                        }
-                                }
-                        }
-                        else
-                        {
-                                output_file_reason = REASON_REWRITE;
-                        }
-                }
-                else
-                {
-                        output_file_reason = REASON_REWRITE;
-                }
-        }
-
-        if (output_file_reason == REASON_REWRITE)
-        {
-                o = fopen(args.output, "w");
-        }
-        else if (output_file_reason == REASON_APPEND)
-        {
-                o = fopen(args.output, "a");
-        }
-        else if (output_file_reason == REASON_STDOUT)
-        {
-                o = stdout;
-        }
-        else if (output_file_reason == REASON_CANCEL)
-        {
-                list_free(&head, &tail);
-                fprintf(stdout, "Cancelled by user.\n");
-                return EXIT_SUCCESS;
-        }
-
-        if (!o)
-        {
-                list_free(&head, &tail);
-                fprintf(stderr, "Cannot open file: %s %s\n", args.input, strerror(errno));
-                return EXIT_FAILURE;
-        }
-
-        addr_list_t *p = head;
-        while (p)
-        {
-                rc = fprintf(o, "%s", args.prefix);
-                if (rc < 0)
-                {
-                        fprintf(stderr, "I/O error: %s", strerror(errno));
-                        list_free(&head, &tail);
-                        return EXIT_FAILURE;
-                }
-                addr_print_v4(o, &p->addr);
-                rc = fprintf(o, "%s", args.postfix);
-                if (rc < 0)
-                {
-                        fprintf(stderr, "I/O error: %s", strerror(errno));
-                        list_free(&head, &tail);
-                        return EXIT_FAILURE;
-                }
-                p = p->next;
-        }
-
-        list_free(&head, &tail);
-        return EXIT_SUCCESS;
-}
\ No newline at end of file
+#ifdef __linux__
+// CPU_SET() and pthread_setaffinity_np() for --affinity
+#define _GNU_SOURCE
+#endif
+#include "cidrips.h"
+#include "cidrips_lpm.h"
+#include "version.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <windows.h>
+#endif
+#ifdef HAVE_ZLIB
+// zlib exports compress() which clashes with compress() below
+#define compress zlib_compress
+#include <zlib.h>
+#undef compress
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+typedef struct
+{
+        unsigned int addr;
+        int cidr;
+        unsigned int label;
+} addr_t;
+
+typedef struct addr_list
+{
+        addr_t addr;
+        size_t count;
+        struct addr_list *next, *prev;
+} addr_list_t;
+
+/*
+ * List nodes are cut from arena chunks instead of one malloc() per node, so
+ * nodes of a list lie densely in address order. Chunk is one huge page on
+ * Linux (madvise(MADV_HUGEPAGE)) and long list walks do not miss TLB. Arena
+ * is per thread: memory is first touched (and placed on NUMA node) by the
+ * worker using it, and node must be freed by the thread which allocated it.
+ * Freed nodes are reused, chunks are kept until arena_release().
+ */
+#define ARENA_CHUNK (2 << 20)
+
+typedef struct arena_chunk
+{
+        struct arena_chunk *next;
+} arena_chunk_t;
+
+/*
+ * Arena of one thread. Every node must be freed by the thread which
+ * allocated it: a list is built, aggregated and freed by one worker (task
+ * of pool_run() or main thread). live counts nodes of this arena only, and
+ * when it drops to 0 free list and current chunk are reset, so a node freed
+ * on another thread would break both arenas.
+ */
+typedef struct
+{
+        arena_chunk_t *first, *current;
+        size_t used;       // bytes of current chunk
+        size_t live;       // allocated nodes
+        addr_list_t *free; // freed nodes linked by next
+} arena_t;
+
+#ifdef HAVE_PTHREAD
+static _Thread_local arena_t arena;
+#else
+static arena_t arena;
+#endif
+
+static arena_chunk_t *arena_chunk_new(void)
+{
+        arena_chunk_t *c;
+#ifdef HAVE_MMAP
+        // map twice the size and cut chunk aligned to huge page
+        char *p = mmap((void *)0, 2 * ARENA_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0), *a;
+        if (p == MAP_FAILED)
+        {
+                return (void *)0;
+        }
+        a = (char *)(((uintptr_t)p + ARENA_CHUNK - 1) & ~(uintptr_t)(ARENA_CHUNK - 1));
+        if (a > p)
+        {
+                munmap(p, a - p);
+        }
+        munmap(a + ARENA_CHUNK, p + ARENA_CHUNK - a);
+#ifdef MADV_HUGEPAGE
+        madvise(a, ARENA_CHUNK, MADV_HUGEPAGE);
+#endif
+        c = (arena_chunk_t *)a;
+#else
+        c = malloc(ARENA_CHUNK);
+        if (!c)
+        {
+                return (void *)0;
+        }
+#endif
+        c->next = (void *)0;
+        return c;
+}
+
+/*
+ * Return chunks of this thread to the system if all its nodes are freed.
+ * Called by workers before exit.
+ */
+static void arena_release(void)
+{
+        arena_chunk_t *c, *next;
+        if (arena.live > 0)
+        {
+                return;
+        }
+        for (c = arena.first; c; c = next)
+        {
+                next = c->next;
+#ifdef HAVE_MMAP
+                munmap(c, ARENA_CHUNK);
+#else
+                free(c);
+#endif
+        }
+        arena.first = (void *)0;
+        arena.current = (void *)0;
+        arena.free = (void *)0;
+        arena.used = 0;
+}
+
+static addr_list_t *list_item_alloc(void)
+{
+        addr_list_t *p = arena.free;
+        arena_chunk_t *c;
+        if (p)
+        {
+                arena.free = p->next;
+        }
+        else
+        {
+                if (!arena.current || arena.used + sizeof(addr_list_t) > ARENA_CHUNK)
+                {
+                        c = arena.current ? arena.current->next : arena.first;
+                        if (!c)
+                        {
+                                c = arena_chunk_new();
+                                if (!c)
+                                {
+                                        return (void *)0;
+                                }
+                                if (arena.current)
+                                {
+                                        arena.current->next = c;
+                                }
+                                else
+                                {
+                                        arena.first = c;
+                                }
+                        }
+                        arena.current = c;
+                        arena.used = sizeof(arena_chunk_t);
+                }
+                p = (addr_list_t *)((char *)arena.current + arena.used);
+                arena.used += sizeof(addr_list_t);
+        }
+        arena.live++;
+        p->count = 0;
+        p->next = (void *)0;
+        p->prev = (void *)0;
+        return p;
+}
+
+static void list_item_free(addr_list_t *p)
+{
+        p->next = arena.free;
+        arena.free = p;
+        if (--arena.live == 0)
+        {
+                // all nodes are free, next list is cut again from first chunk in address order
+                arena.free = (void *)0;
+                arena.current = (void *)0;
+        }
+}
+
+#if defined(__linux__) && defined(HAVE_PTHREAD)
+#define HAVE_AFFINITY
+
+/*
+ * --affinity: CPUs of threads. Main thread (inserter and aggregation) is
+ * pinned to the first CPU, reader, tokenizer and pool workers take next CPUs
+ * round robin. Memory of workers is first touched by them, so CPUs of one
+ * NUMA node keep the whole run on that node.
+ */
+typedef struct
+{
+        int cpus[CPU_SETSIZE];
+        int count;
+        _Atomic unsigned int next;
+} affinity_t;
+
+static affinity_t affinity;
+
+static int affinity_set(int cpu)
+{
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/*
+ * CPU list as in /sys: 0-7,16,18-19.
+ */
+static int affinity_parse(const char *s)
+{
+        char *end;
+        long a, b;
+        affinity.count = 0;
+        while (1)
+        {
+                if (*s < '0' || *s > '9')
+                {
+                        return 0;
+                }
+                a = b = strtol(s, &end, 10);
+                if (*end == '-')
+                {
+                        s = end + 1;
+                        if (*s < '0' || *s > '9')
+                        {
+                                return 0;
+                        }
+                        b = strtol(s, &end, 10);
+                }
+                if (b < a || b >= CPU_SETSIZE)
+                {
+                        return 0;
+                }
+                for (; a <= b && affinity.count < CPU_SETSIZE; a++)
+                {
+                        affinity.cpus[affinity.count++] = (int)a;
+                }
+                if (*end != ',')
+                {
+                        return *end == '\0' || *end == '\n';
+                }
+                s = end + 1;
+        }
+}
+#endif
+
+/*
+ * Parse --affinity (CPU list or nodeN for CPUs of NUMA node) and pin calling
+ * thread. Returns 0 with error message on failure.
+ */
+static int affinity_init(const char *spec)
+{
+#ifdef HAVE_AFFINITY
+        char path[64], buf[4096];
+        FILE *f;
+        size_t n;
+        int rc;
+        if (strncmp(spec, "node", 4) == 0 && spec[4] != '\0' && strlen(spec) < 16 &&
+            strspn(spec + 4, "0123456789") == strlen(spec + 4))
+        {
+                snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", spec);
+                f = fopen(path, "r");
+                if (!f)
+                {
+                        fprintf(stderr, "--affinity: no NUMA node %s.\n", spec + 4);
+                        return 0;
+                }
+                n = fread(buf, 1, sizeof(buf) - 1, f);
+                fclose(f);
+                buf[n] = '\0';
+                spec = buf;
+        }
+        if (!affinity_parse(spec))
+        {
+                fprintf(stderr, "--affinity: invalid value, CPU list (e.g. 0-7,16) or nodeN.\n");
+                affinity.count = 0;
+                return 0;
+        }
+        if ((rc = affinity_set(affinity.cpus[0])) != 0)
+        {
+                fprintf(stderr, "--affinity: cannot use CPU %d: %s\n", affinity.cpus[0], strerror(rc));
+                affinity.count = 0;
+                return 0;
+        }
+        atomic_store(&affinity.next, 1);
+        return 1;
+#else
+        fprintf(stderr, "--affinity: not supported on this platform.\n");
+        return 0;
+#endif
+}
+
+#ifdef HAVE_PTHREAD
+/*
+ * Pin calling worker thread to next CPU of --affinity.
+ */
+static void affinity_pin(void)
+{
+#ifdef HAVE_AFFINITY
+        if (affinity.count > 0)
+        {
+                affinity_set(affinity.cpus[atomic_fetch_add(&affinity.next, 1) % affinity.count]);
+        }
+#endif
+}
+#endif
+
+/*
+ * Page faults of the process so far, to see effect of huge pages and
+ * --affinity. Returns 0 if not available.
+ */
+static int page_faults(long *minor, long *major)
+{
+#ifdef HAVE_MMAP
+        struct rusage ru;
+        if (getrusage(RUSAGE_SELF, &ru) == 0)
+        {
+                *minor = ru.ru_minflt;
+                *major = ru.ru_majflt;
+                return 1;
+        }
+#endif
+        return 0;
+}
+
+static inline int64_t addr_raw_mask(addr_t *addr, int cidr)
+{
+        return addr->addr & (~0UL << (32 - cidr));
+}
+
+static inline size_t addr_v4_weight(int cidr)
+{
+        return 1ULL << (32 - cidr);
+}
+
+static void list_remove(addr_list_t **head, addr_list_t **tail, addr_list_t *item)
+{
+        if (item->prev)
+        {
+                item->prev->next = item->next;
+        }
+        else
+        {
+                *head = item->next;
+        }
+        if (item->next)
+        {
+                item->next->prev = item->prev;
+        }
+        else
+        {
+                *tail = item->prev;
+        }
+        item->next = (void *)0;
+        item->prev = (void *)0;
+}
+
+static void list_free(addr_list_t **head, addr_list_t **tail)
+{
+        addr_list_t *p = *head, *t;
+        while (p)
+        {
+                t = p->next;
+                list_remove(head, tail, p);
+                list_item_free(p);
+                p = t;
+        }
+}
+
+static int list_copy(addr_list_t *head, addr_list_t **thead, addr_list_t **ttail)
+{
+        addr_list_t *p0 = head;
+        addr_list_t *item;
+        while (p0)
+        {
+                item = list_item_alloc();
+                if (!item)
+                {
+                        return 0;
+                }
+                memmove(item, p0, sizeof(addr_list_t));
+                item->prev = (void *)0;
+                item->next = (void *)0;
+                if (*thead)
+                {
+                        item->prev = *ttail;
+                        (*ttail)->next = item;
+                        *ttail = item;
+                }
+                else
+                {
+                        *thead = item;
+                        *ttail = item;
+                }
+                p0 = p0->next;
+        }
+        return 1;
+}
+
+typedef struct
+{
+        addr_t addr;
+        size_t count;
+} addr_entry_t;
+
+/*
+ * Sorted set of parsed addresses. Input is accumulated unsorted, then
+ * set_sort() orders it and drops duplicates in O(n).
+ */
+typedef struct
+{
+        addr_entry_t *items;
+        size_t len, cap;
+} addr_set_t;
+
+#define LABELS_MAX (1 << 26)
+
+/*
+ * Sort key of address: label, the last address of the subnet, then prefix
+ * length descending. Subnet goes after all subnets it contains, so every
+ * aggregated subnet is contiguous run in sorted list, and every label is
+ * contiguous run too. Equal keys mean the same subnet.
+ */
+static inline uint64_t addr_sort_key(const addr_t *addr)
+{
+        uint32_t end = addr->addr | (uint32_t)(addr_v4_weight(addr->cidr) - 1);
+        return ((uint64_t)addr->label << 38) | ((uint64_t)end << 6) | (uint64_t)(32 - addr->cidr);
+}
+
+static int set_reserve(addr_set_t *set, size_t len)
+{
+        addr_entry_t *items;
+        size_t cap = set->cap ? set->cap : 4096;
+        if (len <= set->cap)
+        {
+                return 1;
+        }
+        while (cap < len)
+        {
+                cap *= 2;
+        }
+        items = realloc(set->items, cap * sizeof(addr_entry_t));
+        if (!items)
+        {
+                return 0;
+        }
+        set->items = items;
+        set->cap = cap;
+        return 1;
+}
+
+static int set_append(addr_set_t *set, const addr_entry_t *items, size_t len)
+{
+        if (!set_reserve(set, set->len + len))
+        {
+                return 0;
+        }
+        memcpy(set->items + set->len, items, len * sizeof(addr_entry_t));
+        set->len += len;
+        return 1;
+}
+
+static void set_free(addr_set_t *set)
+{
+        free(set->items);
+        set->items = (void *)0;
+        set->len = set->cap = 0;
+}
+
+/*
+ * Stable LSD radix sort by addr_sort_key(), bytes equal for all keys are
+ * skipped. Duplicates are removed keeping first one, same as insertion of
+ * each address into sorted list.
+ */
+static int set_sort(addr_set_t *set)
+{
+        size_t(*hist)[256], i, j, n = set->len, sum, t;
+        addr_entry_t *src = set->items, *dst, *swap;
+        uint64_t key, first;
+        int d;
+        if (n < 2)
+        {
+                return 1;
+        }
+        hist = calloc(8, sizeof(*hist));
+        dst = malloc(n * sizeof(addr_entry_t));
+        if (!hist || !dst)
+        {
+                free(hist);
+                free(dst);
+                return 0;
+        }
+        for (i = 0; i < n; i++)
+        {
+                key = addr_sort_key(&src[i].addr);
+                for (d = 0; d < 8; d++)
+                {
+                        hist[d][(key >> (d * 8)) & 0xff]++;
+                }
+        }
+        first = addr_sort_key(&src[0].addr);
+        for (d = 0; d < 8; d++)
+        {
+                if (hist[d][(first >> (d * 8)) & 0xff] == n)
+                {
+                        continue;
+                }
+                for (j = 0, sum = 0; j < 256; j++)
+                {
+                        t = hist[d][j];
+                        hist[d][j] = sum;
+                        sum += t;
+                }
+                for (i = 0; i < n; i++)
+                {
+                        key = addr_sort_key(&src[i].addr);
+                        dst[hist[d][(key >> (d * 8)) & 0xff]++] = src[i];
+                }
+                swap = src;
+                src = dst;
+                dst = swap;
+        }
+        free(hist);
+        free(dst);
+        set->items = src;
+        set->cap = n;
+        for (i = 1, j = 0; i < n; i++)
+        {
+                if (addr_sort_key(&src[i].addr) != addr_sort_key(&src[j].addr))
+                {
+                        src[++j] = src[i];
+                }
+        }
+        set->len = j + 1;
+        return 1;
+}
+
+/*
+ * Approximate peak bytes per set entry: set with doubling capacity and sort
+ * buffer while parsing, list nodes and list copy of --mode=count later.
+ */
+#define SET_ENTRY_PEAK_BYTES 96
+
+/*
+ * --max-memory: set is collapsed when it grows over max_len entries. cidr
+ * and used_level record the coarsest prefix and loosest level collapse
+ * needed.
+ */
+typedef struct
+{
+        size_t max_len;
+        int level;
+        size_t collapses;
+        int cidr;
+        int used_level;
+} set_limit_t;
+
+/*
+ * Replace every run of sorted set inside one prefix of given length (same
+ * label) by the prefix itself, if run is dense enough by the same rule as
+ * compress(): sum >= weight >> level. Runs stay contiguous and sorted.
+ */
+static void set_collapse(addr_set_t *set, int cidr, int level)
+{
+        addr_entry_t *items = set->items, e;
+        uint32_t mask = cidr > 0 ? ~0U << (32 - cidr) : 0, base;
+        size_t i, j, out = 0, sum;
+        for (i = 0; i < set->len; i = j)
+        {
+                e = items[i];
+                base = e.addr.addr & mask;
+                sum = 0;
+                for (j = i; j < set->len && items[j].addr.label == e.addr.label && items[j].addr.cidr >= cidr &&
+                            (items[j].addr.addr & mask) == base;
+                     j++)
+                {
+                        sum += items[j].count;
+                }
+                if (j - i > 1 && sum >= (addr_v4_weight(cidr) >> level))
+                {
+                        e.addr.addr = base;
+                        e.addr.cidr = cidr;
+                        e.count = sum;
+                        items[out++] = e;
+                        continue;
+                }
+                if (j == i)
+                {
+                        // larger prefix than collapsed one
+                        j = i + 1;
+                }
+                memmove(items + out, items + i, (j - i) * sizeof(addr_entry_t));
+                out += j - i;
+        }
+        set->len = out;
+}
+
+/*
+ * Shrink sorted set (set_sort() dropped duplicates) below half of limit:
+ * collapse dense /24, /16, /8 at requested level, and only then loosen the
+ * level.
+ */
+static void set_shrink(addr_set_t *set, set_limit_t *limit)
+{
+        static const int prefixes[] = {24, 16, 8, 0};
+        size_t target = limit->max_len / 2, len;
+        int level, k;
+        limit->collapses++;
+        for (level = limit->level; set->len > target && level <= 32; level++)
+        {
+                for (k = 0; k < 4 && set->len > target; k++)
+                {
+                        len = set->len;
+                        set_collapse(set, prefixes[k], level);
+                        if (set->len == len)
+                        {
+                                continue;
+                        }
+                        if (prefixes[k] < limit->cidr)
+                        {
+                                limit->cidr = prefixes[k];
+                        }
+                        if (level > limit->used_level)
+                        {
+                                limit->used_level = level;
+                        }
+                }
+        }
+}
+
+/*
+ * Merge sorted set src into sorted set dst in O(n + m). On equal keys entry
+ * of dst is kept, same as set_sort() keeps first.
+ */
+static int set_merge(addr_set_t *dst, const addr_set_t *src)
+{
+        size_t i = 0, j = 0, n = 0, cap = dst->len + src->len + 1;
+        addr_entry_t *items = malloc(cap * sizeof(addr_entry_t));
+        uint64_t a, b;
+        if (!items)
+        {
+                return 0;
+        }
+        while (i < dst->len && j < src->len)
+        {
+                a = addr_sort_key(&dst->items[i].addr);
+                b = addr_sort_key(&src->items[j].addr);
+                if (a <= b)
+                {
+                        items[n++] = dst->items[i++];
+                        j += a == b;
+                }
+                else
+                {
+                        items[n++] = src->items[j++];
+                }
+        }
+        memcpy(items + n, dst->items + i, (dst->len - i) * sizeof(addr_entry_t));
+        n += dst->len - i;
+        memcpy(items + n, src->items + j, (src->len - j) * sizeof(addr_entry_t));
+        n += src->len - j;
+        free(dst->items);
+        dst->items = items;
+        dst->len = n;
+        dst->cap = cap;
+        return 1;
+}
+
+/*
+ * Binary search of subnet in sorted set (host bits are not compared).
+ */
+static int set_find(const addr_set_t *set, const addr_t *addr)
+{
+        size_t lo = 0, hi = set->len, mid;
+        uint64_t key = addr_sort_key(addr), k;
+        while (lo < hi)
+        {
+                mid = lo + (hi - lo) / 2;
+                k = addr_sort_key(&set->items[mid].addr);
+                if (k == key)
+                {
+                        return 1;
+                }
+                if (k < key)
+                {
+                        lo = mid + 1;
+                }
+                else
+                {
+                        hi = mid;
+                }
+        }
+        return 0;
+}
+
+static int set_to_list(const addr_set_t *set, addr_list_t **head, addr_list_t **tail)
+{
+        addr_list_t *item;
+        size_t i;
+        for (i = 0; i < set->len; i++)
+        {
+                item = list_item_alloc();
+                if (!item)
+                {
+                        return 0;
+                }
+                item->addr = set->items[i].addr;
+                item->count = set->items[i].count;
+                item->prev = *tail;
+                if (*tail)
+                {
+                        (*tail)->next = item;
+                }
+                else
+                {
+                        *head = item;
+                }
+                *tail = item;
+        }
+        return 1;
+}
+
+/*
+ * Decimal number of 1 to 3 digits not greater than max, no sign. Returns
+ * count of parsed symbols, 0 if there is no such number.
+ */
+static int addr_parse_number(const char *data, unsigned int max, unsigned int *v)
+{
+        int n = 0;
+        *v = 0;
+        while (n < 3 && data[n] >= '0' && data[n] <= '9')
+        {
+                *v = *v * 10 + (unsigned int)(data[n] - '0');
+                n++;
+        }
+        if (n == 0 || (data[n] >= '0' && data[n] <= '9') || *v > max)
+        {
+                return 0;
+        }
+        return n;
+}
+
+/*
+ * a.b.c.d at the beginning of data. Returns count of parsed symbols, 0 if
+ * an octet is empty, signed or greater than 255.
+ */
+static int addr_parse_v4_octets(const char *data, uint32_t *addr)
+{
+        unsigned int octet;
+        int i, n, len = 0;
+        *addr = 0;
+        for (i = 0; i < 4; i++)
+        {
+                if (i > 0 && data[len++] != '.')
+                {
+                        return 0;
+                }
+                n = addr_parse_number(data + len, 255, &octet);
+                if (n == 0)
+                {
+                        return 0;
+                }
+                len += n;
+                *addr = (*addr << 8) | octet;
+        }
+        return len;
+}
+
+static int addr_parse_v4_wildcard(char *data, addr_t *addr)
+{
+        int i, n, wild = 0;
+        unsigned int octet;
+        addr->addr = 0;
+        for (i = 0; i < 4; i++)
+        {
+                if (i > 0)
+                {
+                        if (*data != '.')
+                        {
+                                return 0;
+                        }
+                        data++;
+                }
+                if (*data == '*')
+                {
+                        octet = 0;
+                        wild++;
+                        data++;
+                }
+                else
+                {
+                        // wildcard allowed only in trailing octets: 10.1.*.*
+                        if (wild || (n = addr_parse_number(data, 255, &octet)) == 0)
+                        {
+                                return 0;
+                        }
+                        data += n;
+                }
+                addr->addr = (addr->addr << 8) | octet;
+        }
+        if (*data != '\0')
+        {
+                return 0;
+        }
+        addr->cidr = 32 - wild * 8;
+        return 1;
+}
+
+static int addr_parse_v4_netmask(char *data, int *cidr)
+{
+        int n;
+        uint32_t inv;
+        n = addr_parse_v4_octets(data + 1, &inv);
+        if (data[0] != '/' || n == 0 || data[n + 1] != '\0')
+        {
+                return 0;
+        }
+        inv = ~inv;
+        // mask must be contiguous: 255.255.0.0 ok, 255.0.255.0 not
+        if (inv & (inv + 1))
+        {
+                return 0;
+        }
+        *cidr = 32;
+        while (inv)
+        {
+                (*cidr)--;
+                inv >>= 1;
+        }
+        return 1;
+}
+
+static int addr_parse_v4(char *data, size_t size, addr_t *addr)
+{
+        int n;
+        unsigned int cidr;
+        if (strchr(data, '*'))
+        {
+                return addr_parse_v4_wildcard(data, addr);
+        }
+        n = addr_parse_v4_octets(data, &addr->addr);
+        if (n == 0)
+        {
+                return 0;
+        }
+        data += n;
+        size -= n;
+        addr->cidr = 32;
+        if (size > 0)
+        {
+                if (strchr(data, '.'))
+                {
+                        if (!addr_parse_v4_netmask(data, &addr->cidr))
+                        {
+                                return 0;
+                        }
+                }
+                else
+                {
+                        n = addr_parse_number(data + 1, 32, &cidr);
+                        if (data[0] != '/' || n == 0 || data[n + 1] != '\0')
+                        {
+                                return 0;
+                        }
+                        addr->cidr = (int)cidr;
+                }
+        }
+        return 1;
+}
+
+static int addr_parse_v4_range(char *data, uint32_t *first, uint32_t *last)
+{
+        int n, m;
+        n = addr_parse_v4_octets(data, first);
+        if (n == 0 || data[n] != '-')
+        {
+                return 0;
+        }
+        m = addr_parse_v4_octets(data + n + 1, last);
+        if (m == 0 || data[n + 1 + m] != '\0')
+        {
+                return 0;
+        }
+        return *first <= *last;
+}
+
+static size_t addr_format_v4(char *s, addr_t *addr)
+{
+        char *p = s;
+        unsigned int v;
+        int i, shift;
+        for (i = 0; i < 5; i++)
+        {
+                if (i < 4)
+                {
+                        shift = 24 - i * 8;
+                        v = (addr->addr >> shift) & 0xff;
+                        if (i > 0)
+                        {
+                                *p++ = '.';
+                        }
+                }
+                else if (addr->cidr != 32)
+                {
+                        v = addr->cidr;
+                        *p++ = '/';
+                }
+                else
+                {
+                        break;
+                }
+                if (v >= 100)
+                {
+                        *p++ = '0' + v / 100;
+                }
+                if (v >= 10)
+                {
+                        *p++ = '0' + v / 10 % 10;
+                }
+                *p++ = '0' + v % 10;
+        }
+        *p = '\0';
+        return p - s;
+}
+
+#define OUT_BUF_SIZE (1 << 16)
+
+/*
+ * Buffered output writer. Errors are sticky and checked once by caller
+ * after out_flush().
+ */
+typedef struct
+{
+        FILE *f;
+        size_t len;
+        int err;
+        char buf[OUT_BUF_SIZE];
+} out_t;
+
+static void out_flush(out_t *o)
+{
+        if (o->len > 0 && !o->err && fwrite(o->buf, 1, o->len, o->f) != o->len)
+        {
+                o->err = errno ? errno : EIO;
+        }
+        o->len = 0;
+        if (!o->err && fflush(o->f) != 0)
+        {
+                o->err = errno ? errno : EIO;
+        }
+}
+
+static void out_write(out_t *o, const char *data, size_t size)
+{
+        if (o->len + size > OUT_BUF_SIZE)
+        {
+                if (o->len > 0 && !o->err && fwrite(o->buf, 1, o->len, o->f) != o->len)
+                {
+                        o->err = errno ? errno : EIO;
+                }
+                o->len = 0;
+                if (size > OUT_BUF_SIZE)
+                {
+                        if (!o->err && fwrite(data, 1, size, o->f) != size)
+                        {
+                                o->err = errno ? errno : EIO;
+                        }
+                        return;
+                }
+        }
+        memcpy(o->buf + o->len, data, size);
+        o->len += size;
+}
+
+static inline void out_puts(out_t *o, const char *s)
+{
+        out_write(o, s, strlen(s));
+}
+
+static inline void out_addr_v4(out_t *o, addr_t *addr)
+{
+        char s[20];
+        out_write(o, s, addr_format_v4(s, addr));
+}
+
+static void out_size(out_t *o, size_t v)
+{
+        char s[24];
+        int n = sizeof(s);
+        do
+        {
+                s[--n] = '0' + v % 10;
+                v /= 10;
+        } while (v);
+        out_write(o, s + n, sizeof(s) - n);
+}
+
+typedef struct
+{
+        size_t addr_col, addr_row, col, row;
+        int c;
+} parse_pos_t;
+
+enum
+{
+        PARSE_OK = 0,
+        PARSE_EADDR = 1,
+        PARSE_ESYMBOL = 2,
+        PARSE_EMEM = 3,
+        PARSE_EIO = 4,
+        PARSE_EDATA = 5,
+        PARSE_ELABEL = 6,
+        PARSE_ENOLABEL = 7
+};
+
+#define INPUT_BUF_SIZE (1 << 20)
+// gzip and zstd are detected by first 4 bytes
+#define INPUT_MAGIC_SIZE 4
+#define READER_CHUNKS 8
+
+enum
+{
+        INPUT_PLAIN = 0,
+        INPUT_GZIP = 1,
+        INPUT_ZSTD = 2
+};
+
+enum
+{
+        INPUT_OK = 0,
+        INPUT_EIO = 1,
+        INPUT_EDATA = 2
+};
+
+/*
+ * Decompressor for gzip/zstd input. With pthreads it runs on reader thread,
+ * so decompression overlaps with parsing, without pthreads parser calls
+ * decoder_fill() directly on refill.
+ */
+typedef struct decoder
+{
+        FILE *f;
+        int format;
+        unsigned char *raw;
+        size_t raw_pos, raw_len;
+        int raw_eof;
+        int stream_end;
+        int done;
+        int err;
+#ifdef HAVE_ZLIB
+        z_stream z;
+#endif
+#ifdef HAVE_ZSTD
+        ZSTD_DStream *zs;
+#endif
+} decoder_t;
+
+#ifdef HAVE_PTHREAD
+#define SPSC_SIZE 16
+
+/*
+ * Lock-free single producer/single consumer queue. Pipeline stages exchange
+ * fixed pool of buffers through pair of queues (full and free): memory is
+ * bounded and producer waits when consumer does not return buffers. Pools
+ * are smaller than SPSC_SIZE so push never overflows.
+ */
+// end of stream marker, null means empty queue
+static char spsc_end;
+#define SPSC_END ((void *)&spsc_end)
+
+typedef struct
+{
+        void *slots[SPSC_SIZE];
+        _Atomic size_t head;
+        _Atomic size_t tail;
+} spsc_t;
+
+static void spsc_push(spsc_t *q, void *item)
+{
+        size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        q->slots[tail % SPSC_SIZE] = item;
+        atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+}
+
+static void *spsc_pop(spsc_t *q)
+{
+        size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+        void *item;
+        if (head == atomic_load_explicit(&q->tail, memory_order_acquire))
+        {
+                return (void *)0;
+        }
+        item = q->slots[head % SPSC_SIZE];
+        atomic_store_explicit(&q->head, head + 1, memory_order_release);
+        return item;
+}
+
+/*
+ * Spin, then yield, then sleep while queue is empty. Returns null if stop
+ * flag (optional) raised.
+ */
+static void *spsc_pop_wait(spsc_t *q, _Atomic int *stop)
+{
+        void *item;
+        unsigned int spins = 0;
+        struct timespec ts = {0, 20000};
+        while (!(item = spsc_pop(q)))
+        {
+                if (stop && atomic_load_explicit(stop, memory_order_relaxed))
+                {
+                        return (void *)0;
+                }
+                spins++;
+                if (spins > 1024)
+                {
+                        nanosleep(&ts, (void *)0);
+                }
+                else if (spins > 64)
+                {
+                        sched_yield();
+                }
+        }
+        return item;
+}
+
+typedef struct
+{
+        unsigned char *data;
+        size_t len;
+} chunk_t;
+
+/*
+ * Reader stage: large reads (or decompression) into pool of READER_CHUNKS
+ * buffers on own thread. Empty chunk marks end of input.
+ */
+typedef struct reader
+{
+        pthread_t thread;
+        spsc_t full, free;
+        chunk_t chunks[READER_CHUNKS];
+        chunk_t *held;
+        _Atomic int stop;
+        int err;
+} reader_t;
+#endif
+
+typedef struct input
+{
+        FILE *f;
+        unsigned char *buf, *own;
+        size_t pos, len;
+        long remain;
+        int format;
+        int err;
+        int (*refill)(struct input *in);
+        decoder_t *dec;
+#ifdef HAVE_PTHREAD
+        reader_t *reader;
+#endif
+} input_t;
+
+static inline int input_getc(input_t *in)
+{
+        if (in->pos == in->len && !in->refill(in))
+        {
+                return EOF;
+        }
+        return in->buf[in->pos++];
+}
+
+static int input_refill_plain(input_t *in)
+{
+        size_t size = INPUT_BUF_SIZE;
+        if (in->remain >= 0 && (size_t)in->remain < size)
+        {
+                size = (size_t)in->remain;
+        }
+        in->pos = 0;
+        in->len = size > 0 ? fread(in->buf, 1, size, in->f) : 0;
+        if (in->remain >= 0)
+        {
+                in->remain -= (long)in->len;
+        }
+        if (in->len == 0)
+        {
+                if (ferror(in->f))
+                {
+                        in->err = INPUT_EIO;
+                }
+                return 0;
+        }
+        return 1;
+}
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+static int decoder_raw_fill(decoder_t *dec)
+{
+        if (dec->raw_pos < dec->raw_len)
+        {
+                return 1;
+        }
+        if (dec->raw_eof)
+        {
+                return 0;
+        }
+        dec->raw_pos = 0;
+        dec->raw_len = fread(dec->raw, 1, INPUT_BUF_SIZE, dec->f);
+        if (dec->raw_len == 0)
+        {
+                dec->raw_eof = 1;
+                if (ferror(dec->f))
+                {
+                        dec->err = INPUT_EIO;
+                }
+                return 0;
+        }
+        return 1;
+}
+
+#endif
+
+#ifdef HAVE_ZLIB
+static size_t decoder_read_gzip(decoder_t *dec, unsigned char *out, size_t size)
+{
+        int rc;
+        dec->z.next_out = out;
+        dec->z.avail_out = (uInt)size;
+        while (dec->z.avail_out > 0 && !dec->done)
+        {
+                if (!decoder_raw_fill(dec))
+                {
+                        // eof must be at the end of gzip member
+                        if (!dec->err && !dec->stream_end)
+                        {
+                                dec->err = INPUT_EDATA;
+                        }
+                        dec->done = 1;
+                        break;
+                }
+                dec->z.next_in = dec->raw + dec->raw_pos;
+                dec->z.avail_in = (uInt)(dec->raw_len - dec->raw_pos);
+                rc = inflate(&dec->z, Z_NO_FLUSH);
+                dec->raw_pos = dec->raw_len - dec->z.avail_in;
+                if (rc == Z_STREAM_END)
+                {
+                        // concatenated gzip members: continue with next one
+                        dec->stream_end = 1;
+                        inflateReset(&dec->z);
+                }
+                else if (rc == Z_OK)
+                {
+                        dec->stream_end = 0;
+                }
+                else if (rc != Z_BUF_ERROR)
+                {
+                        dec->err = INPUT_EDATA;
+                        dec->done = 1;
+                }
+        }
+        return size - dec->z.avail_out;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static size_t decoder_read_zstd(decoder_t *dec, unsigned char *out, size_t size)
+{
+        size_t rc;
+        ZSTD_inBuffer ib;
+        ZSTD_outBuffer ob = {out, size, 0};
+        while (ob.pos < ob.size && !dec->done)
+        {
+                if (!decoder_raw_fill(dec))
+                {
+                        // flush data buffered inside decoder before finish
+                        ib.src = dec->raw;
+                        ib.size = 0;
+                        ib.pos = 0;
+                        rc = dec->stream_end ? 0 : ZSTD_decompressStream(dec->zs, &ob, &ib);
+                        if (!dec->stream_end && (ZSTD_isError(rc) || ob.pos == 0))
+                        {
+                                if (!dec->err)
+                                {
+                                        dec->err = INPUT_EDATA;
+                                }
+                                dec->done = 1;
+                        }
+                        else if (dec->stream_end || rc == 0)
+                        {
+                                dec->done = 1;
+                        }
+                        break;
+                }
+                ib.src = dec->raw;
+                ib.size = dec->raw_len;
+                ib.pos = dec->raw_pos;
+                rc = ZSTD_decompressStream(dec->zs, &ob, &ib);
+                dec->raw_pos = ib.pos;
+                if (ZSTD_isError(rc))
+                {
+                        dec->err = INPUT_EDATA;
+                        dec->done = 1;
+                        break;
+                }
+                dec->stream_end = rc == 0;
+        }
+        return ob.pos;
+}
+#endif
+
+static size_t decoder_read(decoder_t *dec, unsigned char *out, size_t size)
+{
+#ifdef HAVE_ZLIB
+        if (dec->format == INPUT_GZIP)
+        {
+                return decoder_read_gzip(dec, out, size);
+        }
+#endif
+#ifdef HAVE_ZSTD
+        if (dec->format == INPUT_ZSTD)
+        {
+                return decoder_read_zstd(dec, out, size);
+        }
+#endif
+        dec->err = INPUT_EDATA;
+        dec->done = 1;
+        return 0;
+}
+
+static size_t decoder_fill(decoder_t *dec, unsigned char *out)
+{
+        size_t n = 0;
+        while (n < INPUT_BUF_SIZE && !dec->done)
+        {
+                n += decoder_read(dec, out + n, INPUT_BUF_SIZE - n);
+        }
+        return n;
+}
+
+#ifdef HAVE_PTHREAD
+static void *reader_thread(void *arg)
+{
+        input_t *in = arg;
+        reader_t *r = in->reader;
+        chunk_t *chunk;
+        affinity_pin();
+        do
+        {
+                chunk = spsc_pop_wait(&r->free, &r->stop);
+                if (!chunk)
+                {
+                        break;
+                }
+                if (in->dec)
+                {
+                        chunk->len = decoder_fill(in->dec, chunk->data);
+                        if (chunk->len == 0)
+                        {
+                                r->err = in->dec->err;
+                        }
+                }
+                else
+                {
+                        chunk->len = fread(chunk->data, 1, INPUT_BUF_SIZE, in->f);
+                        if (chunk->len == 0 && ferror(in->f))
+                        {
+                                r->err = INPUT_EIO;
+                        }
+                }
+                spsc_push(&r->full, chunk);
+        } while (chunk->len > 0);
+        return (void *)0;
+}
+
+static int input_refill_reader(input_t *in)
+{
+        reader_t *r = in->reader;
+        chunk_t *chunk;
+        if (r->held)
+        {
+                if (r->held->len == 0)
+                {
+                        return 0;
+                }
+                spsc_push(&r->free, r->held);
+                r->held = (void *)0;
+        }
+        chunk = spsc_pop_wait(&r->full, &r->stop);
+        if (!chunk)
+        {
+                return 0;
+        }
+        r->held = chunk;
+        in->buf = chunk->data;
+        in->len = chunk->len;
+        in->pos = 0;
+        if (chunk->len == 0)
+        {
+                in->err = r->err;
+                return 0;
+        }
+        return 1;
+}
+
+static int reader_start(input_t *in)
+{
+        reader_t *r = calloc(1, sizeof(reader_t));
+        int i;
+        if (!r)
+        {
+                return 0;
+        }
+        in->reader = r;
+        for (i = 0; i < READER_CHUNKS; i++)
+        {
+                // first chunk read for detection goes through pipeline as is
+                if (i == 0 && in->own)
+                {
+                        r->chunks[i].data = in->own;
+                        r->chunks[i].len = in->len;
+                        in->own = (void *)0;
+                        spsc_push(&r->full, &r->chunks[i]);
+                        continue;
+                }
+                r->chunks[i].data = malloc(INPUT_BUF_SIZE);
+                if (!r->chunks[i].data)
+                {
+                        return 0;
+                }
+                spsc_push(&r->free, &r->chunks[i]);
+        }
+        in->buf = (void *)0;
+        in->pos = in->len = 0;
+        if (pthread_create(&r->thread, (void *)0, reader_thread, in) != 0)
+        {
+                return 0;
+        }
+        in->refill = input_refill_reader;
+        return 1;
+}
+
+static void reader_stop(input_t *in)
+{
+        reader_t *r = in->reader;
+        int i;
+        if (in->refill == input_refill_reader)
+        {
+                // thread may be blocked in read() of pipe, cancel it
+                atomic_store(&r->stop, 1);
+                pthread_cancel(r->thread);
+                pthread_join(r->thread, (void *)0);
+        }
+        for (i = 0; i < READER_CHUNKS; i++)
+        {
+                free(r->chunks[i].data);
+        }
+        free(r);
+        in->reader = (void *)0;
+}
+#else
+static int input_refill_decoder(input_t *in)
+{
+        in->pos = 0;
+        in->len = decoder_fill(in->dec, in->buf);
+        if (in->len == 0)
+        {
+                in->err = in->dec->err;
+                return 0;
+        }
+        return 1;
+}
+#endif
+
+/*
+ * Read first INPUT_MAGIC_SIZE bytes (less at end of input) into buffer.
+ * Returns 0 if nothing was read.
+ */
+static int input_peek(input_t *in)
+{
+        size_t size = INPUT_MAGIC_SIZE;
+        if (in->remain >= 0 && (size_t)in->remain < size)
+        {
+                size = (size_t)in->remain;
+        }
+        in->pos = 0;
+        in->len = size > 0 ? fread(in->buf, 1, size, in->f) : 0;
+        if (in->remain >= 0)
+        {
+                in->remain -= (long)in->len;
+        }
+        if (in->len < size && ferror(in->f))
+        {
+                in->err = INPUT_EIO;
+        }
+        return in->len > 0;
+}
+
+static int input_detect(unsigned char *data, size_t size)
+{
+        if (size >= 2 && data[0] == 0x1f && data[1] == 0x8b)
+        {
+                return INPUT_GZIP;
+        }
+        if (size >= 4 && data[0] == 0x28 && data[1] == 0xb5 && data[2] == 0x2f && data[3] == 0xfd)
+        {
+                return INPUT_ZSTD;
+        }
+        return INPUT_PLAIN;
+}
+
+static int decoder_start(input_t *in)
+{
+        decoder_t *dec = calloc(1, sizeof(decoder_t));
+        int rc = 1;
+        if (!dec)
+        {
+                return 0;
+        }
+        in->dec = dec;
+        dec->f = in->f;
+        dec->format = in->format;
+        // first chunk already read for detection is decoder input now
+        dec->raw = in->own;
+        dec->raw_len = in->len;
+        in->own = (void *)0;
+        in->buf = (void *)0;
+        in->pos = in->len = 0;
+#ifdef HAVE_ZLIB
+        if (dec->format == INPUT_GZIP)
+        {
+                // 15 + 32: max window, auto detect gzip/zlib header
+                rc = inflateInit2(&dec->z, 15 + 32) == Z_OK;
+        }
+#endif
+#ifdef HAVE_ZSTD
+        if (dec->format == INPUT_ZSTD)
+        {
+                dec->zs = ZSTD_createDStream();
+                rc = dec->zs != (void *)0;
+        }
+#endif
+        if (!rc)
+        {
+                return 0;
+        }
+#ifndef HAVE_PTHREAD
+        in->own = malloc(INPUT_BUF_SIZE);
+        in->buf = in->own;
+        if (!in->buf)
+        {
+                return 0;
+        }
+        in->refill = input_refill_decoder;
+#endif
+        return 1;
+}
+
+static void input_close(input_t *in)
+{
+        decoder_t *dec = in->dec;
+#ifdef HAVE_PTHREAD
+        if (in->reader)
+        {
+                reader_stop(in);
+        }
+#endif
+        if (dec)
+        {
+#ifdef HAVE_ZLIB
+                if (dec->format == INPUT_GZIP)
+                {
+                        inflateEnd(&dec->z);
+                }
+#endif
+#ifdef HAVE_ZSTD
+                if (dec->zs)
+                {
+                        ZSTD_freeDStream(dec->zs);
+                }
+#endif
+                free(dec->raw);
+                free(dec);
+        }
+        free(in->own);
+        if (in->f && in->f != stdin)
+        {
+                fclose(in->f);
+        }
+        memset(in, 0, sizeof(input_t));
+}
+
+/*
+ * Open input file (or stdin for "-") and detect compression by magic bytes.
+ * Returns 0 with errno set on failure.
+ */
+static int input_open(input_t *in, const char *path, long offset, long length)
+{
+        memset(in, 0, sizeof(input_t));
+        in->f = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+        if (!in->f)
+        {
+                return 0;
+        }
+        // only plain file is read by range (appended tail in --watch), length < 0 is whole file
+        in->remain = length;
+        if (offset > 0 && fseek(in->f, offset, SEEK_SET) != 0)
+        {
+                input_close(in);
+                return 0;
+        }
+        in->own = malloc(INPUT_BUF_SIZE);
+        if (!in->own)
+        {
+                input_close(in);
+                errno = ENOMEM;
+                return 0;
+        }
+        in->buf = in->own;
+        in->refill = input_refill_plain;
+        // only magic is read here, slow pipe is not held back until whole buffer arrives
+        if (!input_peek(in) && in->err)
+        {
+                input_close(in);
+                errno = EIO;
+                return 0;
+        }
+        in->format = input_detect(in->buf, in->len);
+        if (in->format == INPUT_PLAIN)
+        {
+#ifdef HAVE_PTHREAD
+                struct stat st;
+                // regular files are fast to fread inline, pipes go to reader thread
+                if (fstat(fileno(in->f), &st) == 0 && S_ISREG(st.st_mode))
+                {
+                        return 1;
+                }
+                if (!reader_start(in))
+                {
+                        input_close(in);
+                        errno = ENOMEM;
+                        return 0;
+                }
+#endif
+                return 1;
+        }
+#ifndef HAVE_ZLIB
+        if (in->format == INPUT_GZIP)
+        {
+                input_close(in);
+                errno = ENOTSUP;
+                return 0;
+        }
+#endif
+#ifndef HAVE_ZSTD
+        if (in->format == INPUT_ZSTD)
+        {
+                input_close(in);
+                errno = ENOTSUP;
+                return 0;
+        }
+#endif
+        if (!decoder_start(in))
+        {
+                input_close(in);
+                errno = ENOMEM;
+                return 0;
+        }
+#ifdef HAVE_PTHREAD
+        if (!reader_start(in))
+        {
+                input_close(in);
+                errno = ENOMEM;
+                return 0;
+        }
+#endif
+        return 1;
+}
+
+/*
+ * Labels of --label-column mode. Label id is index in names, ids are given
+ * in order of first appearance. Open addressing table keeps id + 1.
+ */
+typedef struct
+{
+        int column;
+        char **names;
+        size_t count, cap;
+        uint32_t *table;
+        size_t table_size;
+} labels_t;
+
+static uint32_t label_hash(const char *s, size_t len)
+{
+        uint32_t h = 2166136261u;
+        size_t i;
+        for (i = 0; i < len; i++)
+        {
+                h = (h ^ (unsigned char)s[i]) * 16777619u;
+        }
+        return h;
+}
+
+static int labels_grow(labels_t *labels)
+{
+        size_t size = labels->table_size ? labels->table_size * 2 : 1024, i, j;
+        uint32_t *table = calloc(size, sizeof(uint32_t));
+        char **names = realloc(labels->names, size / 2 * sizeof(char *));
+        if (!table || !names)
+        {
+                free(table);
+                if (names)
+                {
+                        labels->names = names;
+                }
+                return 0;
+        }
+        for (i = 0; i < labels->count; i++)
+        {
+                j = label_hash(names[i], strlen(names[i])) & (size - 1);
+                while (table[j])
+                {
+                        j = (j + 1) & (size - 1);
+                }
+                table[j] = (uint32_t)i + 1;
+        }
+        free(labels->table);
+        labels->table = table;
+        labels->table_size = size;
+        labels->names = names;
+        labels->cap = size / 2;
+        return 1;
+}
+
+/*
+ * Find id of label, new label gets next id. Returns 0 if out of memory or
+ * too many labels.
+ */
+static int labels_find(labels_t *labels, const char *name, size_t len, unsigned int *id)
+{
+        size_t j;
+        char *s;
+        if (labels->count == labels->cap && (labels->count == LABELS_MAX || !labels_grow(labels)))
+        {
+                return 0;
+        }
+        j = label_hash(name, len) & (labels->table_size - 1);
+        while (labels->table[j])
+        {
+                s = labels->names[labels->table[j] - 1];
+                if (strncmp(s, name, len) == 0 && s[len] == '\0')
+                {
+                        *id = labels->table[j] - 1;
+                        return 1;
+                }
+                j = (j + 1) & (labels->table_size - 1);
+        }
+        s = malloc(len + 1);
+        if (!s)
+        {
+                return 0;
+        }
+        memcpy(s, name, len);
+        s[len] = '\0';
+        labels->names[labels->count] = s;
+        labels->table[j] = (uint32_t)++labels->count;
+        *id = labels->count - 1;
+        return 1;
+}
+
+static void labels_free(labels_t *labels)
+{
+        size_t i;
+        for (i = 0; i < labels->count; i++)
+        {
+                free(labels->names[i]);
+        }
+        free(labels->names);
+        free(labels->table);
+        labels->names = (void *)0;
+        labels->table = (void *)0;
+        labels->count = labels->cap = labels->table_size = 0;
+}
+
+#define INGEST_BATCH_SIZE 65536
+#define INGEST_BATCHES 8
+
+typedef struct
+{
+        size_t len;
+        addr_entry_t items[INGEST_BATCH_SIZE];
+} addr_batch_t;
+
+/*
+ * --max-memory budget: parser batches and input buffers are fixed, every
+ * set entry also has 2 slots of limited dedup table. Set of less than
+ * SET_LIMIT_MIN_LEN entries would be collapsed on every batch, so smaller
+ * limit is rejected by arg_max_memory().
+ */
+#define SET_LIMIT_FIXED_BYTES (INGEST_BATCHES * sizeof(addr_batch_t) + (READER_CHUNKS + 1) * (size_t)INPUT_BUF_SIZE)
+#define SET_LIMIT_ENTRY_BYTES (SET_ENTRY_PEAK_BYTES + 2 * sizeof(uint64_t))
+#define SET_LIMIT_MIN_LEN ((size_t)1 << 18)
+#define SET_LIMIT_MIN_MEMORY (SET_LIMIT_FIXED_BYTES + SET_LIMIT_MIN_LEN * SET_LIMIT_ENTRY_BYTES)
+
+static void set_limit_init(set_limit_t *limit, size_t max_memory, int level)
+{
+        memset(limit, 0, sizeof(set_limit_t));
+        limit->max_len = (max_memory - SET_LIMIT_FIXED_BYTES) / SET_LIMIT_ENTRY_BYTES;
+        limit->level = level;
+        limit->cidr = 33;
+        limit->used_level = level;
+}
+
+/*
+ * Duplicate filter in front of the set. Log-derived input repeats each
+ * address many times, filter keeps only first one so set and sort see
+ * distinct subnets. Sort keys are kept in open addressing hash table, on
+ * large input (table over DEDUP_TABLE_MAX) host addresses without label go
+ * to bitmap of whole IPv4 space instead, its pages are allocated by OS on
+ * first write. Filter never fails: without memory it stops to remember new
+ * keys and set_sort() drops the rest of duplicates. The same way filter is
+ * bypassed when less than 1/DEDUP_MIN_REPEATS of a window of input items are
+ * repeats: hashing and table memory are not worth it, set_sort() is cheaper.
+ * After DEDUP_BYPASS_WINDOWS windows filter is tried again from empty table.
+ */
+#define DEDUP_TABLE_MAX (1 << 25)
+#define DEDUP_BITMAP_BYTES (1ULL << 29)
+#define DEDUP_PREFETCH 8
+#define DEDUP_WINDOW (1 << 20)
+#define DEDUP_MIN_REPEATS 16
+#define DEDUP_BYPASS_WINDOWS 16
+
+typedef struct
+{
+        uint64_t *table;
+        size_t table_size, table_used;
+        int table_bits;
+        int full;
+        uint64_t *bitmap;
+        size_t total, duplicates;
+        size_t window_total, window_duplicates;
+        size_t bypass; // items left to pass without filter
+} dedup_t;
+
+static inline size_t dedup_hash(uint64_t key, int bits)
+{
+        return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+static int dedup_grow(dedup_t *dedup, size_t max_size)
+{
+        int bits = dedup->table_bits ? dedup->table_bits + 1 : 12;
+        size_t size = (size_t)1 << bits, i, j;
+        uint64_t *table;
+        if (size > max_size || !(table = calloc(size, sizeof(uint64_t))))
+        {
+                return 0;
+        }
+        for (i = 0; i < dedup->table_size; i++)
+        {
+                if (dedup->table[i])
+                {
+                        for (j = dedup_hash(dedup->table[i], bits); table[j]; j = (j + 1) & (size - 1))
+                        {
+                        }
+                        table[j] = dedup->table[i];
+                }
+        }
+        free(dedup->table);
+        dedup->table = table;
+        dedup->table_size = size;
+        dedup->table_bits = bits;
+        return 1;
+}
+
+/*
+ * Returns 1 if key was seen before, else remembers it (if there is room).
+ */
+static int dedup_seen(dedup_t *dedup, uint64_t key, size_t max_size)
+{
+        size_t j;
+        // stored as key + 1, 0 is empty slot
+        key++;
+        if (dedup->table_used * 2 >= dedup->table_size && !dedup->full && !dedup_grow(dedup, max_size))
+        {
+                dedup->full = 1;
+        }
+        if (!dedup->table)
+        {
+                return 0;
+        }
+        for (j = dedup_hash(key, dedup->table_bits); dedup->table[j]; j = (j + 1) & (dedup->table_size - 1))
+        {
+                if (dedup->table[j] == key)
+                {
+                        return 1;
+                }
+        }
+        // full table is filled up to 3/4, then only known keys are found
+        if (!dedup->full || dedup->table_used * 4 < dedup->table_size * 3)
+        {
+                dedup->table[j] = key;
+                dedup->table_used++;
+        }
+        return 0;
+}
+
+/*
+ * Free filter memory, counters are kept for statistics.
+ */
+static void dedup_free(dedup_t *dedup)
+{
+        free(dedup->table);
+        free(dedup->bitmap);
+        dedup->table = dedup->bitmap = (void *)0;
+        dedup->table_size = dedup->table_used = 0;
+        dedup->table_bits = 0;
+        dedup->full = 0;
+}
+
+/*
+ * Drop items seen before, compacts items in place and returns new length.
+ * If max_size (table slots) is given, table is kept within it and bitmap is
+ * not used.
+ */
+static size_t dedup_filter(dedup_t *dedup, addr_entry_t *items, size_t len, size_t max_size)
+{
+        size_t i, n = 0;
+        uint64_t bit, ahead;
+        uint32_t a;
+        if (dedup->bypass > 0)
+        {
+                dedup->bypass -= len < dedup->bypass ? len : dedup->bypass;
+                dedup->total += len;
+                return len;
+        }
+        if (max_size == 0 && !dedup->bitmap && dedup->full)
+        {
+                dedup->bitmap = calloc(DEDUP_BITMAP_BYTES / sizeof(uint64_t), sizeof(uint64_t));
+        }
+        for (i = 0; i < len; i++)
+        {
+#ifdef __GNUC__
+                // table is larger than cache, slot of item ahead is loaded while this one is probed
+                if (dedup->table && i + DEDUP_PREFETCH < len)
+                {
+                        ahead = addr_sort_key(&items[i + DEDUP_PREFETCH].addr) + 1;
+                        __builtin_prefetch(&dedup->table[dedup_hash(ahead, dedup->table_bits)]);
+                }
+#endif
+                if (dedup->bitmap && items[i].addr.cidr == 32 && items[i].addr.label == 0)
+                {
+                        a = items[i].addr.addr;
+                        bit = 1ULL << (a & 63);
+                        if ((dedup->bitmap[a >> 6] & bit) || dedup_seen(dedup, addr_sort_key(&items[i].addr), 0))
+                        {
+                                continue;
+                        }
+                        dedup->bitmap[a >> 6] |= bit;
+                }
+                else if (dedup_seen(dedup, addr_sort_key(&items[i].addr), max_size ? max_size : DEDUP_TABLE_MAX))
+                {
+                        continue;
+                }
+                items[n++] = items[i];
+        }
+        dedup->total += len;
+        dedup->duplicates += len - n;
+        dedup->window_total += len;
+        dedup->window_duplicates += len - n;
+        if (dedup->window_total >= DEDUP_WINDOW)
+        {
+                if (dedup->window_duplicates * DEDUP_MIN_REPEATS < dedup->window_total)
+                {
+                        dedup_free(dedup);
+                        dedup->bypass = (size_t)DEDUP_WINDOW * DEDUP_BYPASS_WINDOWS;
+                }
+                dedup->window_total = dedup->window_duplicates = 0;
+        }
+        return n;
+}
+
+/*
+ * --estimate input: instead of set every address is counted into occupancy
+ * of its /24 (saturated at 255) and exact count of its /16. Memory is fixed:
+ * 16 MB + 512 KB.
+ */
+typedef struct
+{
+        uint8_t *hist24;
+        uint64_t *hist16;
+        uint64_t source;
+} estimate_t;
+
+static void estimate_add(estimate_t *est, const addr_entry_t *items, size_t len)
+{
+        uint32_t a, q, last;
+        uint64_t w;
+        unsigned int v;
+        size_t i;
+        for (i = 0; i < len; i++)
+        {
+                a = items[i].addr.cidr ? items[i].addr.addr & (~0U << (32 - items[i].addr.cidr)) : 0;
+                w = addr_v4_weight(items[i].addr.cidr);
+                est->source += w;
+                if (items[i].addr.cidr >= 24)
+                {
+                        v = est->hist24[a >> 8] + (unsigned int)w;
+                        est->hist24[a >> 8] = v > 255 ? 255 : (uint8_t)v;
+                        est->hist16[a >> 16] += w;
+                        continue;
+                }
+                memset(est->hist24 + (a >> 8), 255, (size_t)(w >> 8));
+                if (items[i].addr.cidr >= 16)
+                {
+                        est->hist16[a >> 16] += w;
+                        continue;
+                }
+                for (q = a >> 16, last = q + (uint32_t)(w >> 16); q < last; q++)
+                {
+                        est->hist16[q] += 65536;
+                }
+        }
+}
+
+/*
+ * How input is parsed: labels (NULL if no label column), --extract, memory
+ * limit (NULL if no limit), byte range of plain file (length < 0 is up to
+ * the end), duplicate filter shared by inputs (NULL for own filter) and
+ * --estimate histograms (NULL to parse into set).
+ */
+typedef struct
+{
+        labels_t *labels;
+        int extract;
+        set_limit_t *limit;
+        long offset, length;
+        dedup_t *dedup;
+        estimate_t *estimate;
+} ingest_opts_t;
+
+/*
+ * Parser output. Addresses are collected into batch, full batch is passed
+ * to flush(): appended to set directly or sent to inserter thread. With
+ * labels addresses of current line wait in line until label is known.
+ */
+typedef struct ingest
+{
+        addr_batch_t *batch;
+        addr_set_t *set;
+        parse_pos_t pos;
+        labels_t *labels;
+        addr_entry_t *line;
+        size_t line_len, line_cap;
+        int extract;
+        set_limit_t *limit;
+        dedup_t *dedup;
+        estimate_t *estimate;
+        int (*flush)(struct ingest *ing);
+#ifdef HAVE_PTHREAD
+        spsc_t full, free;
+        _Atomic int stop;
+#endif
+} ingest_t;
+
+static int ingest_append(ingest_t *ing, addr_entry_t *items, size_t len)
+{
+        size_t n;
+        if (ing->estimate)
+        {
+                estimate_add(ing->estimate, items, len);
+                return 1;
+        }
+        len = dedup_filter(ing->dedup, items, len, ing->limit ? ing->limit->max_len * 2 : 0);
+        if (ing->limit && ing->set->len + len > ing->limit->max_len)
+        {
+                // repeats passed by filter are dropped here, counted the same way as in ingest_input()
+                n = ing->set->len;
+                if (!set_sort(ing->set))
+                {
+                        return 0;
+                }
+                ing->dedup->duplicates += n - ing->set->len;
+                set_shrink(ing->set, ing->limit);
+        }
+        return set_append(ing->set, items, len);
+}
+
+static int ingest_flush_set(ingest_t *ing)
+{
+        if (!ingest_append(ing, ing->batch->items, ing->batch->len))
+        {
+                return 0;
+        }
+        ing->batch->len = 0;
+        return 1;
+}
+
+static int ingest_push_line(ingest_t *ing, addr_t *addr)
+{
+        addr_entry_t *line;
+        size_t cap;
+        if (ing->line_len == ing->line_cap)
+        {
+                cap = ing->line_cap ? ing->line_cap * 2 : 64;
+                line = realloc(ing->line, cap * sizeof(addr_entry_t));
+                if (!line)
+                {
+                        return 0;
+                }
+                ing->line = line;
+                ing->line_cap = cap;
+        }
+        ing->line[ing->line_len].addr = *addr;
+        ing->line[ing->line_len].count = addr_v4_weight(addr->cidr);
+        ing->line_len++;
+        return 1;
+}
+
+static inline int ingest_push(ingest_t *ing, addr_t *addr)
+{
+        addr_entry_t *e;
+        if (ing->labels)
+        {
+                return ingest_push_line(ing, addr);
+        }
+        e = &ing->batch->items[ing->batch->len++];
+        e->addr = *addr;
+        e->addr.label = 0;
+        e->count = addr_v4_weight(addr->cidr);
+        if (ing->batch->len == INGEST_BATCH_SIZE)
+        {
+                return ing->flush(ing);
+        }
+        return 1;
+}
+
+/*
+ * End of line in label mode: addresses of the line go to batch with label.
+ */
+static int ingest_line_end(ingest_t *ing, unsigned int label)
+{
+        addr_entry_t *e;
+        size_t i;
+        for (i = 0; i < ing->line_len; i++)
+        {
+                e = &ing->batch->items[ing->batch->len++];
+                *e = ing->line[i];
+                e->addr.label = label;
+                if (ing->batch->len == INGEST_BATCH_SIZE && !ing->flush(ing))
+                {
+                        return 0;
+                }
+        }
+        ing->line_len = 0;
+        return 1;
+}
+
+/*
+ * Decompose range first..last into minimal CIDR cover. Each step takes the
+ * largest block aligned at first that does not overrun last, so the loop runs
+ * at most 62 times for any range.
+ */
+static int parse_push_range(ingest_t *ing, uint32_t first, uint32_t last)
+{
+        uint64_t start = first, end = last;
+        addr_t addr;
+        while (start <= end)
+        {
+                addr.cidr = 32;
+                while (addr.cidr > 0 && (start & (addr_v4_weight(addr.cidr - 1) - 1)) == 0 &&
+                       start + addr_v4_weight(addr.cidr - 1) - 1 <= end)
+                {
+                        addr.cidr--;
+                }
+                addr.addr = (uint32_t)start;
+                if (!ingest_push(ing, &addr))
+                {
+                        return PARSE_EMEM;
+                }
+                start += addr_v4_weight(addr.cidr);
+        }
+        return PARSE_OK;
+}
+
+static int parse_push_token(char *b, size_t size, ingest_t *ing)
+{
+        uint32_t first, last;
+        addr_t addr;
+        if (strchr(b, '-'))
+        {
+                if (!addr_parse_v4_range(b, &first, &last))
+                {
+                        return PARSE_EADDR;
+                }
+                return parse_push_range(ing, first, last);
+        }
+        if (!addr_parse_v4(b, size, &addr))
+        {
+                return PARSE_EADDR;
+        }
+        return ingest_push(ing, &addr) ? PARSE_OK : PARSE_EMEM;
+}
+
+static inline int parse_is_separator(int c)
+{
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == ',' || c == EOF;
+}
+
+/*
+ * In label mode column --label-column of each line is label and may contain
+ * any symbols except separators, other columns are addresses.
+ */
+static int parse_input(input_t *in, ingest_t *ing)
+{
+        char b[64] = {0}, *p = b;
+        int c;
+        int rc;
+        parse_pos_t *pos = &ing->pos;
+        int column = 1, label_column = ing->labels ? ing->labels->column : 0, has_label = 0;
+        unsigned int label = 0;
+        pos->col = 1;
+        pos->row = 1;
+        int new_row_use_r = 0;
+        while (1)
+        {
+                c = input_getc(in);
+                pos->c = c;
+                // truncated or unreadable input: last partial token is not reported as invalid address
+                if (c == EOF && in->err == INPUT_EIO)
+                {
+                        return PARSE_EIO;
+                }
+                else if (c == EOF && in->err == INPUT_EDATA)
+                {
+                        return PARSE_EDATA;
+                }
+                if (column == label_column && !parse_is_separator(c))
+                {
+                        if (p - b == 0)
+                        {
+                                pos->addr_col = pos->col;
+                                pos->addr_row = pos->row;
+                        }
+                        *p = c;
+                        p++;
+                        if (p - b > 62)
+                        {
+                                return PARSE_ELABEL;
+                        }
+                        pos->col++;
+                        continue;
+                }
+                switch (c)
+                {
+                case '0':
+                case '1':
+                case '2':
+                case '3':
+                case '4':
+                case '5':
+                case '6':
+                case '7':
+                case '8':
+                case '9':
+                case '.':
+                case '/':
+                case '-':
+                case '*':
+                        if (p - b == 0)
+                        {
+                                pos->addr_col = pos->col;
+                                pos->addr_row = pos->row;
+                        }
+                        *p = c;
+                        p++;
+                        if (p - b > 62)
+                        {
+                                return PARSE_EADDR;
+                        }
+                        break;
+                case ' ':
+                case '\t':
+                case '\r':
+                case '\n':
+                case ',':
+                case EOF:
+                        if (c == '\r')
+                        {
+                                if (new_row_use_r)
+                                {
+                                        return PARSE_ESYMBOL;
+                                }
+                                new_row_use_r = 1;
+                                pos->col = 1;
+                                pos->row++;
+                        }
+                        else if (c == '\n')
+                        {
+                                if (new_row_use_r)
+                                {
+                                        new_row_use_r = 0;
+                                }
+                                else
+                                {
+                                        pos->row++;
+                                }
+                        }
+                        if (p != b)
+                        {
+                                *p = '\0';
+                                if (column == label_column)
+                                {
+                                        if (!labels_find(ing->labels, b, p - b, &label))
+                                        {
+                                                return PARSE_ELABEL;
+                                        }
+                                        has_label = 1;
+                                }
+                                else
+                                {
+                                        rc = parse_push_token(b, p - b, ing);
+                                        if (rc != PARSE_OK)
+                                        {
+                                                return rc;
+                                        }
+                                }
+                                column++;
+                                p = b;
+                        }
+                        if (label_column && (c == '\r' || c == '\n' || c == EOF))
+                        {
+                                if (ing->line_len > 0 && !has_label)
+                                {
+                                        return PARSE_ENOLABEL;
+                                }
+                                if (!ingest_line_end(ing, label))
+                                {
+                                        return PARSE_EMEM;
+                                }
+                                column = 1;
+                                has_label = 0;
+                        }
+                        if (c == EOF)
+                        {
+                                return ing->flush(ing) ? PARSE_OK : PARSE_EMEM;
+                        }
+                        break;
+                default:
+                        return PARSE_ESYMBOL;
+                }
+                pos->col++;
+        }
+        return PARSE_OK;
+}
+
+#define EXTRACT_TOKEN_MAX 32
+
+static inline int ctz32(unsigned int v)
+{
+#ifdef _MSC_VER
+        unsigned long i;
+        _BitScanForward(&i, v);
+        return (int)i;
+#else
+        return __builtin_ctz(v);
+#endif
+}
+
+static inline int ctz64(uint64_t v)
+{
+#ifdef _MSC_VER
+        unsigned long i;
+        _BitScanForward64(&i, v);
+        return (int)i;
+#else
+        return __builtin_ctzll(v);
+#endif
+}
+
+/*
+ * Index of first digit in buf[pos..len) or len. 16 bytes are tested at once,
+ * text between addresses is skipped by whole blocks.
+ */
+static size_t extract_find_digit(const unsigned char *buf, size_t pos, size_t len)
+{
+#if defined(__SSE2__) || defined(_M_X64)
+        const __m128i zero = _mm_set1_epi8('0'), nine = _mm_set1_epi8(9);
+        __m128i d;
+        int mask;
+        for (; pos + 16 <= len; pos += 16)
+        {
+                // digit if byte - '0' <= 9 unsigned
+                d = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)(buf + pos)), zero);
+                mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(d, nine), d));
+                if (mask)
+                {
+                        return pos + ctz32(mask);
+                }
+        }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+        const uint8x16_t zero = vdupq_n_u8('0'), nine = vdupq_n_u8(9);
+        for (; pos + 16 <= len; pos += 16)
+        {
+                if (vmaxvq_u8(vcleq_u8(vsubq_u8(vld1q_u8(buf + pos), zero), nine)))
+                {
+                        break;
+                }
+        }
+#endif
+        for (; pos < len; pos++)
+        {
+                if ((unsigned)(buf[pos] - '0') < 10)
+                {
+                        return pos;
+                }
+        }
+        return len;
+}
+
+static inline int extract_is_word(int c)
+{
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+/*
+ * Validate run of [0-9./] found in text. Address is dotted quad not glued
+ * to word or another dotted number: "1.2.3.4.5", "v1.2.3.4", "1.2.3.4.nip.io"
+ * are rejected, one trailing dot (end of sentence) is allowed. Optional /cidr
+ * is taken if valid, "1.2.3.4/path" gives address only.
+ */
+static int extract_token(const char *s, size_t n, int before, int after, addr_t *addr)
+{
+        size_t i = 0;
+        int k, digits, v;
+        if (before == '.' || extract_is_word(before) || n > EXTRACT_TOKEN_MAX)
+        {
+                return 0;
+        }
+        addr->addr = 0;
+        addr->cidr = 32;
+        for (k = 0; k < 4; k++)
+        {
+                if (k > 0)
+                {
+                        if (i == n || s[i] != '.')
+                        {
+                                return 0;
+                        }
+                        i++;
+                }
+                for (digits = 0, v = 0; i < n && s[i] >= '0' && s[i] <= '9'; i++, digits++)
+                {
+                        v = v * 10 + s[i] - '0';
+                }
+                if (digits == 0 || digits > 3 || v > 255)
+                {
+                        return 0;
+                }
+                addr->addr = (addr->addr << 8) | (unsigned int)v;
+        }
+        if (i < n && s[i] == '/')
+        {
+                for (i++, digits = 0, v = 0; i < n && s[i] >= '0' && s[i] <= '9'; i++, digits++)
+                {
+                        v = v * 10 + s[i] - '0';
+                }
+                if (digits > 0 && digits <= 2 && v <= 32 &&
+                    ((i == n && !extract_is_word(after)) || (i + 1 == n && s[i] == '.')))
+                {
+                        addr->cidr = v;
+                }
+                return 1;
+        }
+        if (i == n)
+        {
+                return !extract_is_word(after);
+        }
+        return i + 1 == n && s[i] == '.' && !extract_is_word(after);
+}
+
+/*
+ * --extract: take addresses from arbitrary text (logs), everything else is
+ * skipped. Runs of digits and dots are validated by extract_token().
+ */
+static int parse_extract(input_t *in, ingest_t *ing)
+{
+        char b[EXTRACT_TOKEN_MAX];
+        size_t i, n;
+        int c, before = ' ';
+        addr_t addr;
+        while (in->pos < in->len || in->refill(in))
+        {
+                i = extract_find_digit(in->buf, in->pos, in->len);
+                if (i > in->pos)
+                {
+                        before = in->buf[i - 1];
+                }
+                in->pos = i;
+                if (i == in->len)
+                {
+                        continue;
+                }
+                // token may continue in next buffer
+                n = 0;
+                while ((c = input_getc(in)) != EOF && ((c >= '0' && c <= '9') || c == '.' || c == '/'))
+                {
+                        if (n < EXTRACT_TOKEN_MAX)
+                        {
+                                b[n] = c;
+                        }
+                        n++;
+                }
+                if (extract_token(b, n, before, c, &addr) && !ingest_push(ing, &addr))
+                {
+                        return PARSE_EMEM;
+                }
+                before = c;
+                if (c == EOF)
+                {
+                        break;
+                }
+        }
+        if (in->err == INPUT_EIO)
+        {
+                return PARSE_EIO;
+        }
+        else if (in->err == INPUT_EDATA)
+        {
+                return PARSE_EDATA;
+        }
+        return ing->flush(ing) ? PARSE_OK : PARSE_EMEM;
+}
+
+static int parse_run(input_t *in, ingest_t *ing)
+{
+        return ing->extract ? parse_extract(in, ing) : parse_input(in, ing);
+}
+
+#ifdef HAVE_PTHREAD
+static int ingest_flush_pipe(ingest_t *ing)
+{
+        spsc_push(&ing->full, ing->batch);
+        ing->batch = spsc_pop_wait(&ing->free, &ing->stop);
+        return ing->batch != (void *)0;
+}
+
+typedef struct
+{
+        input_t *in;
+        ingest_t *ing;
+        int rc;
+} parse_job_t;
+
+static void *parse_thread(void *arg)
+{
+        parse_job_t *job = arg;
+        ingest_t *ing = job->ing;
+        affinity_pin();
+        job->rc = parse_run(job->in, ing);
+        if (ing->batch)
+        {
+                // return unsent batch to pool
+                ing->batch->len = 0;
+                spsc_push(&ing->free, ing->batch);
+                ing->batch = (void *)0;
+        }
+        spsc_push(&ing->full, SPSC_END);
+        return (void *)0;
+}
+
+/*
+ * Tokenizer on own thread sends batches to this (inserter) thread through
+ * lock-free queues. Pool of INGEST_BATCHES batches bounds memory.
+ */
+static int ingest_pipeline(input_t *in, ingest_t *ing)
+{
+        addr_batch_t *batches = malloc(INGEST_BATCHES * sizeof(addr_batch_t));
+        addr_batch_t *batch;
+        parse_job_t job = {in, ing, PARSE_OK};
+        pthread_t thread;
+        int i, rc = PARSE_OK;
+        if (!batches)
+        {
+                return PARSE_EMEM;
+        }
+        for (i = 1; i < INGEST_BATCHES; i++)
+        {
+                batches[i].len = 0;
+                spsc_push(&ing->free, &batches[i]);
+        }
+        batches[0].len = 0;
+        ing->batch = &batches[0];
+        ing->flush = ingest_flush_pipe;
+        if (pthread_create(&thread, (void *)0, parse_thread, &job) != 0)
+        {
+                free(batches);
+                return PARSE_EMEM;
+        }
+        while (1)
+        {
+                // tokenizer always sends end marker, even when stopped
+                batch = spsc_pop_wait(&ing->full, (void *)0);
+                if (batch == SPSC_END)
+                {
+                        break;
+                }
+                if (rc == PARSE_OK && !ingest_append(ing, batch->items, batch->len))
+                {
+                        // keep draining until tokenizer sees stop
+                        atomic_store(&ing->stop, 1);
+                        atomic_store(&in->reader->stop, 1);
+                        rc = PARSE_EMEM;
+                }
+                batch->len = 0;
+                spsc_push(&ing->free, batch);
+        }
+        pthread_join(thread, (void *)0);
+        free(batches);
+        return rc != PARSE_OK ? rc : job.rc;
+}
+#endif
+
+/*
+ * Read whole input into sorted set without duplicates. Input from pipe or
+ * compressed file is processed by reader, tokenizer and inserter threads,
+ * regular file is read inline. Result is the same for both.
+ */
+static int ingest_input(input_t *in, addr_set_t *set, const ingest_opts_t *opts, parse_pos_t *pos)
+{
+        ingest_t ing = {0};
+        dedup_t dedup = {0};
+        size_t len;
+        int rc;
+        ing.set = set;
+        ing.labels = opts->labels;
+        ing.extract = opts->extract;
+        ing.limit = opts->limit;
+        ing.dedup = opts->dedup ? opts->dedup : &dedup;
+        ing.estimate = opts->estimate;
+#ifdef HAVE_PTHREAD
+        if (in->reader)
+        {
+                rc = ingest_pipeline(in, &ing);
+        }
+        else
+#endif
+        {
+                ing.batch = malloc(sizeof(addr_batch_t));
+                if (!ing.batch)
+                {
+                        return PARSE_EMEM;
+                }
+                ing.batch->len = 0;
+                ing.flush = ingest_flush_set;
+                rc = parse_run(in, &ing);
+                free(ing.batch);
+        }
+        free(ing.line);
+        dedup_free(&dedup);
+        *pos = ing.pos;
+        len = set->len;
+        if (rc == PARSE_OK && !set_sort(set))
+        {
+                rc = PARSE_EMEM;
+        }
+        // filter without memory left the rest of duplicates to sort. Set was
+        // distinct before this input (sorted by previous load or by shrink),
+        // so only entries this input added are dropped and each is one repeat
+        ing.dedup->duplicates += len - set->len;
+        return rc;
+}
+
+/*
+ * Parse file into set (appending to existing items) and sort it. On failure
+ * writes error message into err.
+ */
+static int load_input(const char *path, addr_set_t *set, const ingest_opts_t *opts, char *err, size_t err_size)
+{
+        input_t in;
+        parse_pos_t pos = {0};
+        int rc;
+        if (!input_open(&in, path, opts->offset, opts->length))
+        {
+                if (errno == ENOTSUP)
+                {
+                        snprintf(err, err_size, "Cannot read %s: compressed input is not supported by this build.",
+                                 path);
+                }
+                else
+                {
+                        snprintf(err, err_size, "Cannot open file: %s %s", path, strerror(errno));
+                }
+                return 0;
+        }
+        rc = ingest_input(&in, set, opts, &pos);
+        input_close(&in);
+        if (rc == PARSE_EADDR)
+        {
+                snprintf(err, err_size, "Invalid address at %zu:%zu.", pos.addr_row, pos.addr_col);
+        }
+        else if (rc == PARSE_EDATA)
+        {
+                snprintf(err, err_size, "Corrupted compressed input.");
+        }
+        else if (rc == PARSE_EIO)
+        {
+                snprintf(err, err_size, "I/O error: %s.", strerror(errno));
+        }
+        else if (rc == PARSE_EMEM)
+        {
+                snprintf(err, err_size, "Cannot allocate memory.");
+        }
+        else if (rc == PARSE_ESYMBOL)
+        {
+                snprintf(err, err_size, "Unexpected symbol \"%c\" at %zu:%zu.", pos.c, pos.row, pos.col);
+        }
+        else if (rc == PARSE_ELABEL)
+        {
+                snprintf(err, err_size, "Invalid label at %zu:%zu.", pos.addr_row, pos.addr_col);
+        }
+        else if (rc == PARSE_ENOLABEL)
+        {
+                snprintf(err, err_size, "No label in column %d at row %zu.", opts->labels->column, pos.addr_row);
+        }
+        return rc == PARSE_OK;
+}
+
+#define ARGS_MAX_INPUTS 16
+
+#define SNAPSHOT_MAGIC "CIDRSNAP"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_HEADER_SIZE 8192
+
+enum
+{
+        SNAPSHOT_OK = 0,
+        SNAPSHOT_EIO = 1,
+        SNAPSHOT_EBAD = 2,
+        SNAPSHOT_ESTALE = 3,
+        SNAPSHOT_EMEM = 4
+};
+
+typedef struct
+{
+        char path[256];
+        int64_t mtime; // nanoseconds
+        int64_t size;
+} snapshot_source_t;
+
+/*
+ * Snapshot file: header padded to SNAPSHOT_HEADER_SIZE, count entries of
+ * addr_entry_t as is (native byte order and layout, checked on load), then
+ * label names separated by '\0'. Entries are page aligned and used as
+ * sorted set directly from mapping.
+ */
+typedef struct
+{
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t entry_size;
+        int32_t label_column;
+        uint64_t count;
+        uint64_t labels_count;
+        uint64_t labels_size;
+        uint64_t checksum;
+        uint32_t source_count;
+        uint32_t extract;
+        snapshot_source_t sources[ARGS_MAX_INPUTS];
+} snapshot_header_t;
+
+typedef struct
+{
+        snapshot_header_t header;
+        void *map;
+        size_t map_size;
+        addr_set_t set;
+} snapshot_t;
+
+static uint64_t snapshot_checksum(uint64_t h, const void *data, size_t size)
+{
+        const unsigned char *p = data;
+        uint64_t w;
+        size_t i;
+        for (i = 0; i + 8 <= size; i += 8)
+        {
+                memcpy(&w, p + i, 8);
+                h = (h ^ w) * 0x100000001b3ULL;
+                h ^= h >> 29;
+        }
+        for (; i < size; i++)
+        {
+                h = (h ^ p[i]) * 0x100000001b3ULL;
+        }
+        return h;
+}
+
+/*
+ * Modification time in nanoseconds, so rewrite within the same second is
+ * seen where file system keeps them.
+ */
+static int64_t stat_mtime_ns(const struct stat *st)
+{
+#if defined(__APPLE__)
+        return (int64_t)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+#elif defined(__unix__)
+        return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#else
+        return (int64_t)st->st_mtime * 1000000000;
+#endif
+}
+
+/*
+ * Identity of source file for snapshot: path, mtime and size. Stdin has no
+ * identity (-1), so snapshot of it is never valid for --input.
+ */
+static void snapshot_source(const char *path, snapshot_source_t *src)
+{
+        struct stat st;
+        memset(src, 0, sizeof(snapshot_source_t));
+        snprintf(src->path, sizeof(src->path), "%s", path);
+        src->mtime = -1;
+        src->size = -1;
+        if (strcmp(path, "-") != 0 && stat(path, &st) == 0)
+        {
+                src->mtime = stat_mtime_ns(&st);
+                src->size = (int64_t)st.st_size;
+        }
+}
+
+/*
+ * Check that snapshot was made from these inputs and they are unchanged.
+ */
+static int snapshot_valid(const snapshot_header_t *h, char (*inputs)[256], int input_count, int label_column,
+                          int extract)
+{
+        snapshot_source_t src;
+        int i;
+        if ((int)h->source_count != input_count || h->label_column != label_column || (int)h->extract != extract)
+        {
+                return 0;
+        }
+        for (i = 0; i < input_count; i++)
+        {
+                snapshot_source(inputs[i], &src);
+                if (src.mtime < 0 || strcmp(src.path, h->sources[i].path) != 0 || src.mtime != h->sources[i].mtime ||
+                    src.size != h->sources[i].size)
+                {
+                        return 0;
+                }
+        }
+        return 1;
+}
+
+static void snapshot_close(snapshot_t *snap)
+{
+        if (snap->map)
+        {
+#ifdef HAVE_MMAP
+                munmap(snap->map, snap->map_size);
+#else
+                free(snap->map);
+#endif
+        }
+        snap->map = (void *)0;
+        snap->set.items = (void *)0;
+        snap->set.len = 0;
+}
+
+/*
+ * Open snapshot and use its entries as sorted set without parsing. With
+ * inputs snapshot must be made from the same unchanged files, else
+ * SNAPSHOT_ESTALE. Without inputs label column is taken from snapshot.
+ * Labels of snapshot are added to labels. Entries are checked against
+ * checksum only with verify, else pages are not touched before use.
+ */
+static int snapshot_open(snapshot_t *snap, const char *path, char (*inputs)[256], int input_count, labels_t *labels,
+                         int extract, int verify, char *err, size_t err_size)
+{
+        snapshot_header_t *h = &snap->header;
+        FILE *f = fopen(path, "rb");
+        const char *name;
+        const char *end;
+        unsigned int id;
+        uint64_t size;
+        long file_size;
+        memset(snap, 0, sizeof(snapshot_t));
+        if (!f)
+        {
+                snprintf(err, err_size, "Cannot open file: %s %s", path, strerror(errno));
+                return SNAPSHOT_EIO;
+        }
+        if (fread(h, sizeof(snapshot_header_t), 1, f) != 1 || memcmp(h->magic, SNAPSHOT_MAGIC, 8) != 0 ||
+            h->version != SNAPSHOT_VERSION || h->byte_order != 0x01020304 || h->entry_size != sizeof(addr_entry_t) ||
+            h->source_count > ARGS_MAX_INPUTS)
+        {
+                fclose(f);
+                snprintf(err, err_size, "Invalid snapshot: %s", path);
+                return SNAPSHOT_EBAD;
+        }
+        if (input_count > 0 && !snapshot_valid(h, inputs, input_count, labels->column, extract))
+        {
+                fclose(f);
+                return SNAPSHOT_ESTALE;
+        }
+        fseek(f, 0, SEEK_END);
+        file_size = ftell(f);
+        size = SNAPSHOT_HEADER_SIZE + h->count * sizeof(addr_entry_t) + h->labels_size;
+        if (file_size < 0 || (uint64_t)file_size != size || h->count > SIZE_MAX / sizeof(addr_entry_t))
+        {
+                fclose(f);
+                snprintf(err, err_size, "Invalid snapshot: %s", path);
+                return SNAPSHOT_EBAD;
+        }
+        snap->map_size = (size_t)size;
+#ifdef HAVE_MMAP
+        snap->map = mmap((void *)0, snap->map_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+        if (snap->map == MAP_FAILED)
+        {
+                snap->map = (void *)0;
+        }
+#else
+        snap->map = malloc(snap->map_size);
+        if (snap->map && (fseek(f, 0, SEEK_SET) != 0 || fread(snap->map, snap->map_size, 1, f) != 1))
+        {
+                free(snap->map);
+                snap->map = (void *)0;
+        }
+#endif
+        fclose(f);
+        if (!snap->map)
+        {
+                snprintf(err, err_size, "Cannot read file: %s %s", path, strerror(errno));
+                return SNAPSHOT_EIO;
+        }
+        if (verify && snapshot_checksum(0xcbf29ce484222325ULL, (char *)snap->map + SNAPSHOT_HEADER_SIZE,
+                                        snap->map_size - SNAPSHOT_HEADER_SIZE) != h->checksum)
+        {
+                snapshot_close(snap);
+                snprintf(err, err_size, "Corrupted snapshot: %s", path);
+                return SNAPSHOT_EBAD;
+        }
+        name = (char *)snap->map + SNAPSHOT_HEADER_SIZE + h->count * sizeof(addr_entry_t);
+        end = name + h->labels_size;
+        while (name < end)
+        {
+                size = strnlen(name, end - name);
+                if (name + size == end || !labels_find(labels, name, size, &id))
+                {
+                        snapshot_close(snap);
+                        labels_free(labels);
+                        snprintf(err, err_size, "Invalid snapshot labels: %s", path);
+                        return SNAPSHOT_EBAD;
+                }
+                name += size + 1;
+        }
+        if (labels->count != h->labels_count)
+        {
+                snapshot_close(snap);
+                labels_free(labels);
+                snprintf(err, err_size, "Invalid snapshot labels: %s", path);
+                return SNAPSHOT_EBAD;
+        }
+        labels->column = h->label_column;
+        snap->set.items = (addr_entry_t *)((char *)snap->map + SNAPSHOT_HEADER_SIZE);
+        snap->set.len = h->count;
+        return SNAPSHOT_OK;
+}
+
+static int snapshot_write(FILE *f, snapshot_header_t *h, const addr_set_t *set, const char *names, addr_entry_t *buf)
+{
+        size_t i, j, n;
+        if (fwrite(h, SNAPSHOT_HEADER_SIZE, 1, f) != 1)
+        {
+                return 0;
+        }
+        // copy through buffer to zero struct padding, so file is reproducible
+        memset(buf, 0, 4096 * sizeof(addr_entry_t));
+        for (i = 0; i < set->len; i += n)
+        {
+                n = set->len - i < 4096 ? set->len - i : 4096;
+                for (j = 0; j < n; j++)
+                {
+                        buf[j].addr = set->items[i + j].addr;
+                        buf[j].count = set->items[i + j].count;
+                }
+                h->checksum = snapshot_checksum(h->checksum, buf, n * sizeof(addr_entry_t));
+                if (fwrite(buf, sizeof(addr_entry_t), n, f) != n)
+                {
+                        return 0;
+                }
+        }
+        h->checksum = snapshot_checksum(h->checksum, names, h->labels_size);
+        if (h->labels_size > 0 && fwrite(names, h->labels_size, 1, f) != 1)
+        {
+                return 0;
+        }
+        // header again with checksum
+        return fseek(f, 0, SEEK_SET) == 0 && fwrite(h, sizeof(snapshot_header_t), 1, f) == 1;
+}
+
+/*
+ * Write sorted set into snapshot. File is written beside and renamed, so
+ * readers never see partial snapshot. Returns 0 and sets errno on failure.
+ */
+static int snapshot_save(const char *path, const addr_set_t *set, labels_t *labels, int extract,
+                         const snapshot_source_t *sources, int source_count)
+{
+        snapshot_header_t *h = calloc(1, SNAPSHOT_HEADER_SIZE);
+        addr_entry_t *buf = malloc(4096 * sizeof(addr_entry_t));
+        char tmp[300], *names = (void *)0;
+        size_t i, size = 0;
+        FILE *f;
+        int ok = 0;
+        for (i = 0; labels && i < labels->count; i++)
+        {
+                size += strlen(labels->names[i]) + 1;
+        }
+        names = malloc(size + 1);
+        if (!h || !buf || !names)
+        {
+                free(h);
+                free(buf);
+                free(names);
+                errno = ENOMEM;
+                return 0;
+        }
+        for (i = 0, size = 0; labels && i < labels->count; i++)
+        {
+                strcpy(names + size, labels->names[i]);
+                size += strlen(labels->names[i]) + 1;
+        }
+        memcpy(h->magic, SNAPSHOT_MAGIC, 8);
+        h->version = SNAPSHOT_VERSION;
+        h->byte_order = 0x01020304;
+        h->entry_size = sizeof(addr_entry_t);
+        h->label_column = labels ? labels->column : 0;
+        h->count = set->len;
+        h->labels_count = labels ? labels->count : 0;
+        h->labels_size = size;
+        h->checksum = 0xcbf29ce484222325ULL;
+        h->source_count = source_count;
+        h->extract = extract;
+        memcpy(h->sources, sources, source_count * sizeof(snapshot_source_t));
+        snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+        f = fopen(tmp, "wb");
+        if (f)
+        {
+                ok = snapshot_write(f, h, set, names, buf);
+                if (fclose(f) != 0)
+                {
+                        ok = 0;
+                }
+#ifdef _WIN32
+                // rename() does not replace existing file on windows
+                if (ok)
+                {
+                        remove(path);
+                }
+#endif
+                if (!ok || rename(tmp, path) != 0)
+                {
+                        i = errno;
+                        remove(tmp);
+                        errno = (int)i;
+                        ok = 0;
+                }
+        }
+        free(h);
+        free(buf);
+        free(names);
+        return ok;
+}
+
+#define ARGS_MAX_VARIANTS 16
+
+/*
+ * --variant: mode, level or count and output of one more result of the same
+ * input.
+ */
+typedef struct
+{
+        int mode;
+        int level;
+        int count;
+        char output[256];
+} variant_t;
+
+typedef struct
+{
+        char input[ARGS_MAX_INPUTS][256];
+        int input_count;
+        char output[256];
+        char prefix[256];
+        char postfix[256];
+        int mode;
+        int count;
+        int level;
+        int help;
+        int overwrite;
+        int no_stats;
+        int append;
+        int cancel;
+        int format;
+        int chunk_size;
+        char set_name[32];
+        char table[64];
+        char route_args[256];
+        char jobs[256];
+        int threads;
+        int label_column;
+        char label_output[256];
+        char snapshot[256];
+        char save_snapshot[256];
+        int verify_snapshot;
+        int extract;
+        size_t max_memory;
+        int watch;
+        char diff_against[256];
+        char announce_prefix[256];
+        char withdraw_prefix[256];
+        int prefer_old;
+        char report[256];
+        int estimate;
+        variant_t variants[ARGS_MAX_VARIANTS];
+        int variant_count;
+        char affinity[256];
+} args_t;
+
+static void cli_help(FILE *o)
+{
+        // clang-format off
+        fprintf(o,
+                "cidrips v%d.%d.%d.rev%s\nUtlity for compress any IP list groupping "
+                "by CIDR mask.\n\n",
+                cidrips_version_major, cidrips_version_minor, cidrips_version_patch,
+                cidrips_git_rev);
+        fprintf(o, "Usage:\n");
+        fprintf(o, "\tcidrips -i[FILE]\n");
+        fprintf(o, "\tcidrips -i[FILE] -o[FILE]\n");
+        fprintf(o, "\tcidrips -mlevel [-l[level]] -i[FILE] -o[FILE]\n");
+        fprintf(o, "\tcidrips -mcount [-c[count]] -i[FILE] -o[FILE]\n");
+        fprintf(o, "\tcidrips -i[FILE] -p[PREFIX] -P[POSTFIX]\n");
+        fprintf(o, "\tcidrips -j[MANIFEST] [-T[threads]]\n\n");
+        fprintf(o, "Arguments:\n");
+        fprintf(o, "\t-i,--input    [FILE]           Path to file with input ips. (Use \n");
+        fprintf(o, "\t                               --input - for stdin, repeat for several\n");
+        fprintf(o, "\t                               files)\n");
+        fprintf(o, "\t-o,--out      [FILE]           Path to file with output subnets. (Use \n");
+        fprintf(o, "\t                               --input - for stdin)\n");
+        fprintf(o, "\t-m,--mode     [level|count]    Use this method for generate \n");
+        fprintf(o, "\t                               subnets: level >=0, count - maximum count\n");
+        fprintf(o, "\t                               of result subnets.\n");
+        fprintf(o, "\t                               [Default: level]\n");
+        fprintf(o, "\t-l,--level    [LEVEL]          Comression level.  [Default: 0]\n");
+        fprintf(o, "\t-c,--count    [COUNT]          Maxmimum count of result subnets.\n");
+        fprintf(o, "\t                               [Default: not specifie]\n");
+        fprintf(o, "\t-p,--prefix   [prefix]         Prefix for generated subnet in output.\n");
+        fprintf(o, "\t                               [Default: \"\"]\n");
+        fprintf(o, "\t-P,--postfix  [postfix]        Postfix for generated subnet in output.\n");
+        fprintf(o, "\t                               [Default: \"\\n\"\n");
+        fprintf(o, "\t-O, --overwrite                Overwrite output file if not empty\n");
+        fprintf(o, "\t-A, --append                   Append into output file.\n");
+        fprintf(o, "\t-C, --cancel                   Cancel if output file is not empty.\n");
+        fprintf(o, "\t    --no-stats                 No print any statistics\n");
+        fprintf(o, "\t-f,--output-format [FORMAT]    Output format: text, ipset-restore, nft,\n");
+        fprintf(o, "\t                               ip-batch, bird, lpm-table. [Default: text]\n");
+        fprintf(o, "\t-n,--set-name  [NAME]          ipset/nft set or bird protocol name.\n");
+        fprintf(o, "\t                               [Default: cidrips]\n");
+        fprintf(o, "\t-t,--table     [TABLE]         nft table (inet family). [Default: filter]\n");
+        fprintf(o, "\t-k,--chunk-size [SIZE]         nft elements per \"add element\".\n");
+        fprintf(o, "\t                               [Default: 4096]\n");
+        fprintf(o, "\t-r,--route-args [ARGS]         ip-batch/bird route target, e.g. \"via 10.0.0.1\".\n");
+        fprintf(o, "\t                               [Default: blackhole]\n");
+        fprintf(o, "\t-j,--jobs     [FILE]           Run jobs from manifest, one per line with\n");
+        fprintf(o, "\t                               arguments: -i -o -m -l -c -p -P -f ...\n");
+        fprintf(o, "\t                               Inputs are parsed once for all jobs.\n");
+        fprintf(o, "\t-T,--threads  [N]              Worker threads for --jobs and --variant.\n");
+        fprintf(o, "\t                               [Default: number of CPUs]\n");
+        fprintf(o, "\t-L,--label-column [N]          Column N (from 1) of each line is label,\n");
+        fprintf(o, "\t                               subnets are aggregated for each label.\n");
+        fprintf(o, "\t-e,--label-output [TEMPLATE]   Write each label into own file, e.g.\n");
+        fprintf(o, "\t                               out/%%s.txt. [Default: label before\n");
+        fprintf(o, "\t                               subnet in --output]\n");
+        fprintf(o, "\t-S,--snapshot  [FILE]          Use parsed set from snapshot instead of\n");
+        fprintf(o, "\t                               parsing. With --input only if inputs are\n");
+        fprintf(o, "\t                               unchanged since snapshot was saved.\n");
+        fprintf(o, "\t-W,--save-snapshot [FILE]      Save parsed set into snapshot. Without\n");
+        fprintf(o, "\t                               --out only snapshot is written.\n");
+        fprintf(o, "\t-v,--verify-snapshot           Check checksum of whole --snapshot on load.\n");
+        fprintf(o, "\t-x,--extract                   Take addresses from any text (logs),\n");
+        fprintf(o, "\t                               everything else is skipped.\n");
+        fprintf(o, "\t-M,--max-memory [BYTES]        Memory limit (K, M, G suffix). Dense\n");
+        fprintf(o, "\t                               subnets are aggregated early to fit.\n");
+        fprintf(o, "\t-w,--watch                     Aggregate again when input changes\n");
+        fprintf(o, "\t                               (only new lines if file is appended).\n");
+        fprintf(o, "\t-d,--diff-against [FILE]       Output only changes against previous result\n");
+        fprintf(o, "\t                               (text list): new subnets, then removed.\n");
+        fprintf(o, "\t-a,--announce-prefix [prefix]  Prefix for new subnet in diff. Default: +\n");
+        fprintf(o, "\t-u,--withdraw-prefix [prefix]  Prefix for removed subnet in diff. Default: -\n");
+        fprintf(o, "\t-K,--prefer-old                Keep subnets of previous result if merge\n");
+        fprintf(o, "\t                               would not change coverage.\n");
+        fprintf(o, "\t-R,--report [FILE]             Write source count, coverage, density and\n");
+        fprintf(o, "\t                               level of each output subnet. JSON lines if\n");
+        fprintf(o, "\t                               FILE ends with .json or .jsonl, else CSV.\n");
+        fprintf(o, "\t-E,--estimate                  Print approximate subnets and coverage of\n");
+        fprintf(o, "\t                               every level (and level for --count) from\n");
+        fprintf(o, "\t                               one pass over input, without aggregation.\n");
+        fprintf(o, "\t-V,--variant [SPEC]            One more result of the same parsed input,\n");
+        fprintf(o, "\t                               e.g. mode=level,level=2,out=FILE or\n");
+        fprintf(o, "\t                               count=8192,out=FILE. Repeatable, instead of\n");
+        fprintf(o, "\t                               --output. Variants run in parallel.\n");
+        fprintf(o, "\t-F,--affinity [CPUS]           Pin threads to CPUs (Linux): list, e.g.\n");
+        fprintf(o, "\t                               0-7,16, or nodeN for CPUs of NUMA node.\n");
+        fprintf(o, "\t                               Default --threads is count of CPUs.\n\n");
+        fprintf(o, "Input formats:\n");
+        fprintf(o, "\t10.0.0.1, 10.0.0.0/24           Address, CIDR\n");
+        fprintf(o, "\t10.0.0.0/255.255.255.0          Address with netmask\n");
+        fprintf(o, "\t10.0.0.1-10.0.0.20              Range, splitted into minimal CIDR list\n");
+        fprintf(o, "\t10.1.*.*                        Wildcard (only trailing octets)\n");
+        fprintf(o, "\tgzip and zstd compressed input detected automatically (if supported by build).\n");
+        // clang-format on
+}
+
+#define MODE_UNKNOWN 0
+#define MODE_LEVEL 1
+#define MODE_COUNT 2
+
+#define FORMAT_TEXT 0
+#define FORMAT_IPSET 1
+#define FORMAT_NFT 2
+#define FORMAT_IP_BATCH 3
+#define FORMAT_BIRD 4
+#define FORMAT_LPM 5
+
+// ipset limits set name to 31 symbol, restore file builds set in <name>-tmp
+#define IPSET_NAME_MAX 27
+
+#define ARG_OPTIONAL 0x1
+#define ARG_NO_VALUE 0x2
+
+typedef int(arg_handler_cb)(const char *arg_val, args_t *cli_args);
+
+static int arg_input(const char *arg_val, args_t *cli_args)
+{
+        if (arg_val == (void *)0)
+        {
+                return 0;
+        }
+        if (strlen(arg_val) > 255)
+        {
+                fprintf(stderr, "--input: argument too long.\n");
+                return 0;
+        }
+        if (cli_args->input_count == ARGS_MAX_INPUTS)
+        {
+                fprintf(stderr, "--input: too many inputs, maximum %d.\n", ARGS_MAX_INPUTS);
+                return 0;
+        }
+        strcpy(cli_args->input[cli_args->input_count++], arg_val);
+        return 1;
+}
+
+static int arg_output(const char *arg_val, args_t *cli_args)
+{
+        if (arg_val == (void *)0)
+        {
+                cli_args->output[0] = 0;
+        }
+        else if (strlen(arg_val) > 255)
+        {
+                fprintf(stderr, "--output: argument too long.\n");
+                return 0;
+        }
+        else
+        {
+                strcpy(cli_args->output, arg_val);
+                return 1;
+        }
+        return 1;
+}
+
+static int arg_mode(const char *arg_val, args_t *cli_args)
+{
+        if (arg_val == (void *)0)
+        {
+                cli_args->mode = MODE_LEVEL;
+        }
+        else if (strcmp(arg_val, "level") == 0)
+        {
+                cli_args->mode = MODE_LEVEL;
+        }
+        else if (strcmp(arg_val, "count") == 0)
+        {
+                cli_args->mode = MODE_COUNT;
+        }
+        else
+        {
+                fprintf(stderr,
+                        "--mode: invalid value, support only level or count. "
+                        "got: \"%s\"\n",
+                        arg_val);
+                return 0;
+        }
+        return 1;
+}
+
+static int arg_level(const char *arg_val, args_t *cli_args)
+{
+        if (cli_args->mode != MODE_UNKNOWN && cli_args->mode != MODE_LEVEL)
+        {
+                fprintf(stderr, "--level: Unexpected for this mode.\n");
+                return 0;
+        }
+        if (arg_val == (void *)0)
+        {
+                cli_args->level = 0;
+        }
+        else if (arg_val[0] >= '0' && arg_val[0] <= '9')
+        {
+                cli_args->level = atoi(arg_val);
+        }
+        else
+        {
+                fprintf(stderr, "--level: invalid value, non-negative numbers.\n");
+                return 0;
+        }
+        return 1;
+}
+
+static int arg_count(const char *arg_val, args_t *cli_args)
+{
+        if (cli_args->mode != MODE_UNKNOWN && cli_args->mode == MODE_LEVEL)
+        {
+                fprintf(stderr, "--count: Unexpected for this mode.\n");
+                return 0;
+        }
+        if (arg_val == (void *)0)
+        {
+                cli_args->count = 1;
+        }
+        else if (arg_val[0] > '0' && arg_val[0] <= '9')
+        {
+                cli_args->count = atoi(arg_val);
+        }
+        else
+        {
+                fprintf(stderr, "--count: invalid value, positive numbers. got %s\n", arg_val);
+                return 0;
+        }
+        return 1;
+}
+
+static void strcpy_escaped(char *s0, const char *s1)
+{
+        int escape = 0;
+        char *p = (char *)s1;
+        char *out = s0;
+        while (*p)
+        {
+                if (!escape)
+                {
+                        if (*p == '\\')
+                        {
+                                escape = 1;
+                        }
+                        else
+                        {
+                                *out = *p;
+                                out++;
+                        }
+                }
+                else
+                {
+                        escape = 0;
+                        if (*p == 'n')
+                        {
+                                *out = '\n';
+                        }
+                        else if (*p == 'r')
+                        {
+                                *out = '\r';
+                        }
+                        else if (*p == 't')
+                        {
+                                *out = '\t';
+                        }
+                        else
+                        {
+                                *out = '\\';
+                                out++;
+                                *out = *p;
+                        }
+                        out++;
+                }
+                p++;
+        }
+        *out = '\0';
+}
+
+static int arg_prefix(const char *arg_val, args_t *cli_args)
+{
+        if (!arg_val)
+        {
+                cli_args->prefix[0] = '\0';
+                return 1;
+        }
+
+        if (strlen(arg_val) > 255)
+        {
+                fprintf(stderr, "--prefix: argument too long.\n");
+                return 0;
+        }
+        strcpy_escaped(cli_args->prefix, arg_val);
+        return 1;
+}
+
+static int arg_postfix(const char *arg_val, args_t *cli_args)
+{
+        if (!arg_val)
+        {
+                cli_args->prefix[0] = '\n';
+                cli_args->prefix[1] = '\0';
+                return 1;
+        }
+
+        if (strlen(arg_val) > 255)
+        {
+                fprintf(stderr, "--postfix: argument too long.\n");
+                return 0;
+        }
+        strcpy_escaped(cli_args->postfix, arg_val);
+        return 1;
+}
+
+static int arg_overwrite(const char *arg_val, args_t *cli_args)
+{
+        cli_args->overwrite = 1;
+        return 1;
+}
+
+static int arg_append(const char *arg_val, args_t *cli_args)
+{
+        cli_args->append = 1;
+        return 1;
+}
+
+static int arg_cancel(const char *arg_val, args_t *cli_args)
+{
+        cli_args->cancel = 1;
+        return 1;
+}
+
+static int arg_no_stats(const char *arg_val, args_t *cli_args)
+{
+        cli_args->no_stats = 1;
+        return 1;
+}
+
+static int arg_format(const char *arg_val, args_t *cli_args)
+{
+        if (arg_val == (void *)0 || strcmp(arg_val, "text") == 0)
+        {
+                cli_args->format = FORMAT_TEXT;
+        }
+        else if (strcmp(arg_val, "ipset-restore") == 0)
+        {
+                cli_args->format = FORMAT_IPSET;
+        }
+        else if (strcmp(arg_val, "nft") == 0)
+        {
+                cli_args->format = FORMAT_NFT;
+        }
+        else if (strcmp(arg_val, "ip-batch") == 0)
+        {
+                cli_args->format = FORMAT_IP_BATCH;
+        }
+        else if (strcmp(arg_val, "bird") == 0)
+        {
+                cli_args->format = FORMAT_BIRD;
+        }
+        else if (strcmp(arg_val, "lpm-table") == 0)
+        {
+                cli_args->format = FORMAT_LPM;
+        }
+        else
+        {
+                fprintf(stderr,
+                        "--output-format: invalid value, support only text, ipset-restore, nft, ip-batch, bird or "
+                        "lpm-table. got: \"%s\"\n",
+                        arg_val);
+                return 0;
+        }
+        return 1;
+}
+
+static int arg_set_name(const char *arg_val, args_t *cli_args)
+{
+        if (arg_val == (void *)0)
+        {
+                return 1;
+        }
+        // ipset limits set name to 31 symbol
+        if (strlen(arg_val) > 31)
+        {
+                fprintf(stderr, "--set-name: argument too long.\n");
+                return 0;
+        }
+        strcpy(cli_args->set_name, arg_val);
+        return 1;
+}
+
+static int arg_table(const char *arg_val, args_t *cli_args)
+{
+        if (arg_val == (void *)0)
+        {
+                return 1;
+        }
+        if (strlen(arg_val) > 63)
+        {
+                fprintf(stderr, "--table: argument too long.\n");
+                return 0;
+        }
+        strcpy(cli_args->table, arg_val);
+        return 1;
+}
+
+static int arg_chunk_size(const char *arg_val, args_t *cli_args)
+{
+        if (arg_val != (void *)0 && arg_val[0] > '0' && arg_val[0] <= '9')
+        {
+                cli_args->chunk_size = atoi(arg_val);
+                return 1;
+        }
+        fprintf(stderr, "--chunk-size: invalid value, positive numbers.\n");
+        return 0;
+}
+
+static int arg_route_args(const char *arg_val, args_t *cli_args)
+{
+        if (arg_val == (void *)0)
+        {
+                return 1;
+        }
+        if (strlen(arg_val) > 255)
+        {
+                fprintf(stderr, "--route-args: argument too long.\n");
+                return 0;
+        }
+        strcpy(cli_args->route_args, arg_val);
+        return 1;
+}
+
+static int arg_jobs(const char *arg_val, args_t *cli_args)
+{
+        if (arg_val == (void *)0)
+        {
+                return 0;
+        }
+        if (strlen(arg_val) > 255)
+        {
+                fprintf(stderr, "--jobs: argument too long.\n");
+                return 0;
+        }
+        strcpy(cli_args->jobs, arg_val);
+        return 1;
+}
+
+static int arg_threads(const char *arg_val, args_t *cli_args)
+{
+        if (arg_val != (void *)0 && arg_val[0] > '0' && arg_val[0] <= '9')
+        {
+                cli_args->threads = atoi(arg_val);
+                return 1;
+        }
+        fprintf(stderr, "--threads: invalid value, positive numbers.\n");
+        return 0;
+}
+
+static int arg_label_column(const char *arg_val, args_t *cli_args)
+{
+        if (arg_val != (void *)0 && arg_val[0] > '0' && arg_val[0] <= '9')
+        {
+                cli_args->label_column = atoi(arg_val);
+                return 1;
+        }
+        fprintf(stderr, "--label-column: invalid value, positive numbers.\n");
+        return 0;
+}
+
+static int arg_label_output(const char *arg_val, args_t *cli_args)
+{
+        const char *p;
+        if (arg_val == (void *)0)
+        {
+                return 1;
+        }
+        if (strlen(arg_val) > 255)
+        {
+                fprintf(stderr, "--label-output: argument too long.\n");
+                return 0;
+        }
+        // template is used as format string, allow only one %s
+        p = strchr(arg_val, '%');
+        if (!p || p[1] != 's' || strchr(p + 1, '%'))
+        {
+                fprintf(stderr, "--label-output: template must contain one %%s.\n");
+                return 0;
+        }
+        strcpy(cli_args->label_output, arg_val);
+        return 1;
+}
+
+static int arg_snapshot(const char *arg_val, args_t *cli_args)
+{
+        if (arg_val == (void *)0)
+        {
+                return 1;
+        }
+        if (strlen(arg_val) > 255)
+        {
+                fprintf(stderr, "--snapshot: argument too long.\n");
+                return 0;
+        }
+        strcpy(cli_args->snapshot, arg_val);
+        return 1;
+}
+
+static int arg_save_snapshot(const char *arg_val, args_t *cli_args)
+{
+        if (arg_val == (void *)0)
+        {
+                return 1;
+        }
+        if (strlen(arg_val) > 255)
+        {
+                fprintf(stderr, "--save-snapshot: argument too long.\n");
+                return 0;
+        }
+        strcpy(cli_args->save_snapshot, arg_val);
+        return 1;
+}
+
+static int arg_extract(const char *arg_val, args_t *cli_args)
+{
+        cli_args->extract = 1;
+        return 1;
+}
+
+static int arg_max_memory(const char *arg_val, args_t *cli_args)
+{
+        char *end;
+        unsigned long long v;
+        if (arg_val != (void *)0 && arg_val[0] > '0' && arg_val[0] <= '9')
+        {
+                v = strtoull(arg_val, &end, 10);
+                if (*end == 'K' || *end == 'k')
+                {
+                        v <<= 10;
+                        end++;
+                }
+                else if (*end == 'M' || *end == 'm')
+                {
+                        v <<= 20;
+                        end++;
+                }
+                else if (*end == 'G' || *end == 'g')
+                {
+                        v <<= 30;
+                        end++;
+                }
+                if (*end == '\0' && v < SET_LIMIT_MIN_MEMORY)
+                {
+                        fprintf(stderr, "--max-memory: at least %zuM, room for parser buffers and %zu subnets.\n",
+                                (SET_LIMIT_MIN_MEMORY + (1 << 20) - 1) >> 20, SET_LIMIT_MIN_LEN);
+                        return 0;
+                }
+                if (*end == '\0')
+                {
+                        cli_args->max_memory = (size_t)v;
+                        return 1;
+                }
+        }
+        fprintf(stderr, "--max-memory: invalid value, positive numbers with K, M or G suffix.\n");
+        return 0;
+}
+
+static int arg_watch(const char *arg_val, args_t *cli_args)
+{
+        cli_args->watch = 1;
+        return 1;
+}
+
+static int arg_diff_against(const char *arg_val, args_t *cli_args)
+{
+        if (arg_val == (void *)0)
+        {
+                return 1;
+        }
+        if (strlen(arg_val) > 255)
+        {
+                fprintf(stderr, "--diff-against: argument too long.\n");
+                return 0;
+        }
+        strcpy(cli_args->diff_against, arg_val);
+        return 1;
+}
+
+static int arg_announce_prefix(const char *arg_val, args_t *cli_args)
+{
+        if (!arg_val)
+        {
+                cli_args->announce_prefix[0] = '\0';
+                return 1;
+        }
+        if (strlen(arg_val) > 255)
+        {
+                fprintf(stderr, "--announce-prefix: argument too long.\n");
+                return 0;
+        }
+        strcpy_escaped(cli_args->announce_prefix, arg_val);
+        return 1;
+}
+
+static int arg_withdraw_prefix(const char *arg_val, args_t *cli_args)
+{
+        if (!arg_val)
+        {
+                cli_args->withdraw_prefix[0] = '\0';
+                return 1;
+        }
+        if (strlen(arg_val) > 255)
+        {
+                fprintf(stderr, "--withdraw-prefix: argument too long.\n");
+                return 0;
+        }
+        strcpy_escaped(cli_args->withdraw_prefix, arg_val);
+        return 1;
+}
+
+static int arg_verify_snapshot(const char *arg_val, args_t *cli_args)
+{
+        cli_args->verify_snapshot = 1;
+        return 1;
+}
+
+static int arg_prefer_old(const char *arg_val, args_t *cli_args)
+{
+        cli_args->prefer_old = 1;
+        return 1;
+}
+
+static int arg_report(const char *arg_val, args_t *cli_args)
+{
+        if (arg_val == (void *)0)
+        {
+                return 1;
+        }
+        if (strlen(arg_val) > 255)
+        {
+                fprintf(stderr, "--report: argument too long.\n");
+                return 0;
+        }
+        strcpy(cli_args->report, arg_val);
+        return 1;
+}
+
+static int arg_estimate(const char *arg_val, args_t *cli_args)
+{
+        cli_args->estimate = 1;
+        return 1;
+}
+
+/*
+ * --variant mode=level,level=2,out=FILE. Mode may be omitted, it follows
+ * from level= or count=.
+ */
+static int arg_variant(const char *arg_val, args_t *cli_args)
+{
+        variant_t *v;
+        const char *p, *end, *value;
+        size_t key_len, len;
+        if (arg_val == (void *)0)
+        {
+                return 1;
+        }
+        if (cli_args->variant_count == ARGS_MAX_VARIANTS)
+        {
+                fprintf(stderr, "--variant: too many variants, maximum %d.\n", ARGS_MAX_VARIANTS);
+                return 0;
+        }
+        v = &cli_args->variants[cli_args->variant_count];
+        v->mode = MODE_UNKNOWN;
+        v->level = -1;
+        v->count = 0;
+        v->output[0] = '\0';
+        for (p = arg_val; *p; p = *end ? end + 1 : end)
+        {
+                end = strchr(p, ',');
+                end = end ? end : p + strlen(p);
+                value = memchr(p, '=', end - p);
+                if (!value)
+                {
+                        fprintf(stderr, "--variant: expected key=value, got %.*s\n", (int)(end - p), p);
+                        return 0;
+                }
+                key_len = value - p;
+                len = end - ++value;
+                if (key_len == 4 && strncmp(p, "mode", 4) == 0 && len == 5 && strncmp(value, "level", 5) == 0)
+                {
+                        v->mode = MODE_LEVEL;
+                }
+                else if (key_len == 4 && strncmp(p, "mode", 4) == 0 && len == 5 && strncmp(value, "count", 5) == 0)
+                {
+                        v->mode = MODE_COUNT;
+                }
+                else if (key_len == 5 && strncmp(p, "level", 5) == 0 && value[0] >= '0' && value[0] <= '9')
+                {
+                        v->level = atoi(value);
+                }
+                else if (key_len == 5 && strncmp(p, "count", 5) == 0 && value[0] > '0' && value[0] <= '9')
+                {
+                        v->count = atoi(value);
+                }
+                else if (key_len == 3 && strncmp(p, "out", 3) == 0 && len > 0 && len < sizeof(v->output))
+                {
+                        memcpy(v->output, value, len);
+                        v->output[len] = '\0';
+                }
+                else
+                {
+                        fprintf(stderr, "--variant: invalid %.*s\n", (int)(end - p), p);
+                        return 0;
+                }
+        }
+        if (v->mode == MODE_UNKNOWN)
+        {
+                v->mode = v->count ? MODE_COUNT : MODE_LEVEL;
+        }
+        if (!v->output[0] || strcmp(v->output, "-") == 0 || (v->mode == MODE_COUNT && (!v->count || v->level >= 0)) ||
+            (v->mode == MODE_LEVEL && v->count))
+        {
+                fprintf(stderr, "--variant: requires out=FILE and level= for mode=level or count= for mode=count, "
+                                "got %s\n",
+                        arg_val);
+                return 0;
+        }
+        v->level = v->level < 0 ? 0 : v->level;
+        cli_args->variant_count++;
+        return 1;
+}
+
+/*
+ * --affinity 0-7,16 or nodeN, the list is checked by affinity_init() in main.
+ */
+static int arg_affinity(const char *arg_val, args_t *cli_args)
+{
+        if (arg_val != (void *)0 && arg_val[0] != '\0' && strlen(arg_val) < sizeof(cli_args->affinity))
+        {
+                strcpy(cli_args->affinity, arg_val);
+                return 1;
+        }
+        fprintf(stderr, "--affinity: invalid value, CPU list (e.g. 0-7,16) or nodeN.\n");
+        return 0;
+}
+
+static int arg_help(const char *arg_val, args_t *cli_args)
+{
+        cli_args->help = 1;
+        return 1;
+}
+
+static struct argtab
+{
+        int arg_index;
+        const char arg_short;
+        const char *arg_long;
+        int arg_flags;
+        const char *arg_default;
+        const char *arg_description;
+        arg_handler_cb *arg_handler;
+} _argtab[] = {
+    // clang-format off
+    {0, 'h', "help", ARG_OPTIONAL | ARG_NO_VALUE, 0, "Show help.", arg_help},
+    {1, 'i', "input", ARG_OPTIONAL, 0, "Path to input file with ip addresses.", arg_input},
+    // must go before "output", long names are matched by prefix
+    {12, 'f', "output-format", ARG_OPTIONAL, "text", "Output format.", arg_format},
+    {2, 'o', "output", ARG_OPTIONAL, 0, "Path to output file.", arg_output},
+    {3, 'm', "mode", ARG_OPTIONAL, "level", "Compression mode.", arg_mode},
+    {4, 'l', "level", ARG_OPTIONAL, "0", "Compress level. Required for --mode=level.", arg_level},
+    {5, 'c', "count", ARG_OPTIONAL, 0, "Max count of output. Required for --mode=count.", arg_count},
+    {6, 'p', "prefix", ARG_OPTIONAL, "", "Prefix for ouput ip address.", arg_prefix},
+    {7, 'P', "postfix", ARG_OPTIONAL, "\n", "Postfix for ouput ip address", arg_postfix},
+    {8, 'O', "overwrite", ARG_OPTIONAL | ARG_NO_VALUE, 0, "Owerwrite ouput is not empty.", arg_overwrite},
+    {9, 's', "no-stats", ARG_OPTIONAL | ARG_NO_VALUE, 0, "Dont print any statistic info.", arg_no_stats},
+    {10, 'A', "append", ARG_OPTIONAL | ARG_NO_VALUE, 0, "Append file if not empty", arg_append},
+    {11, 'C', "cancel", ARG_OPTIONAL | ARG_NO_VALUE, 0, "Cancel if output file is not empty.", arg_cancel},
+    {13, 'n', "set-name", ARG_OPTIONAL, "cidrips", "Set name for ipset/nft/bird.", arg_set_name},
+    {14, 't', "table", ARG_OPTIONAL, "filter", "nft table.", arg_table},
+    {15, 'k', "chunk-size", ARG_OPTIONAL, "4096", "nft elements per statement.", arg_chunk_size},
+    {16, 'r', "route-args", ARG_OPTIONAL, "blackhole", "ip-batch/bird route target.", arg_route_args},
+    {17, 'j', "jobs", ARG_OPTIONAL, 0, "Manifest with one job per line.", arg_jobs},
+    {18, 'T', "threads", ARG_OPTIONAL, 0, "Worker threads for --jobs and --variant.", arg_threads},
+    {19, 'L', "label-column", ARG_OPTIONAL, 0, "Column with label.", arg_label_column},
+    {20, 'e', "label-output", ARG_OPTIONAL, 0, "Output file template for labels.", arg_label_output},
+    {21, 'S', "snapshot", ARG_OPTIONAL, 0, "Load parsed set from snapshot.", arg_snapshot},
+    {22, 'W', "save-snapshot", ARG_OPTIONAL, 0, "Save parsed set into snapshot.", arg_save_snapshot},
+    {23, 'x', "extract", ARG_OPTIONAL | ARG_NO_VALUE, 0, "Extract addresses from text.", arg_extract},
+    {24, 'M', "max-memory", ARG_OPTIONAL, 0, "Memory limit.", arg_max_memory},
+    {25, 'w', "watch", ARG_OPTIONAL | ARG_NO_VALUE, 0, "Aggregate again on input change.", arg_watch},
+    {26, 'd', "diff-against", ARG_OPTIONAL, 0, "Previous result for diff output.", arg_diff_against},
+    {27, 'a', "announce-prefix", ARG_OPTIONAL, "+", "Prefix for new subnet in diff.", arg_announce_prefix},
+    {28, 'u', "withdraw-prefix", ARG_OPTIONAL, "-", "Prefix for removed subnet in diff.", arg_withdraw_prefix},
+    {29, 'K', "prefer-old", ARG_OPTIONAL | ARG_NO_VALUE, 0, "Keep subnets of previous result.", arg_prefer_old},
+    {30, 'R', "report", ARG_OPTIONAL, 0, "Per-subnet report file.", arg_report},
+    {31, 'E', "estimate", ARG_OPTIONAL | ARG_NO_VALUE, 0, "Estimate result of every level.", arg_estimate},
+    {32, 'V', "variant", ARG_OPTIONAL, 0, "One more output of the same input.", arg_variant},
+    {33, 'F', "affinity", ARG_OPTIONAL, 0, "Pin threads to CPUs.", arg_affinity},
+    {34, 'v', "verify-snapshot", ARG_OPTIONAL | ARG_NO_VALUE, 0, "Check snapshot checksum.", arg_verify_snapshot}};
+// clang-format on
+static int _argtab_size = 35;
+
+static int cli_arg_val_contain(char arg_short, const char *arg_long, const char *argv)
+{
+        // clang-format off
+  if (argv[0] == '-' && argv[1] == arg_short && strlen(argv) == 2)
+    return 0;
+  if (argv[0] == '-' && argv[1] == '-' && strstr(argv, arg_long) == argv + 2 &&
+      strlen(argv) == strlen(arg_long) + 2 && argv[strlen(arg_long) + 2] != '=')
+    return 0;
+        // clang-format on
+        return 1;
+}
+
+static char *cli_arg_val(char arg_short, const char *arg_long, const char *argv)
+{
+        char *p, *pp;
+        if (argv[0] == '-' && argv[1] == arg_short)
+                p = (char *)argv + 2;
+        if (argv[0] == '-' && argv[1] == '-' && strstr(argv, arg_long) == argv + 2)
+                p = (char *)argv + strlen(arg_long) + 2;
+        if (*p == '\0')
+        {
+                return (char *)0;
+        }
+        if (*p == '=')
+        {
+                p++;
+        }
+        if (*p == '"')
+        {
+                p++;
+                pp = strchr(p, '"');
+                if (pp)
+                {
+                        *pp = 0;
+                }
+        }
+        if (*p == '\0')
+        {
+                return (void *)0;
+        }
+        return p;
+}
+
+static struct argtab *find_arg(const char *argv)
+{
+        int i;
+        for (i = 0; i < _argtab_size; i++)
+        {
+                if (argv[0] == '-' && argv[1] == _argtab[i].arg_short)
+                        return &_argtab[i];
+                if (argv[0] == '-' && strstr(argv, _argtab[i].arg_long) == argv + 2)
+                        return &_argtab[i];
+        }
+        return (void *)0;
+}
+
+static int cli_parse(int argc, const char **argv, args_t *args)
+{
+        int i, rc;
+        struct argtab *argtab;
+        int arg_passed[64] = {0};
+        for (i = 1; i < argc; i++)
+        {
+                argtab = find_arg(argv[i]);
+                if (argtab)
+                {
+                        arg_passed[argtab->arg_index] = 1;
+                        if (cli_arg_val_contain(argtab->arg_short, argtab->arg_long, argv[i]))
+                        {
+                                if (argtab->arg_flags & ARG_NO_VALUE)
+                                {
+                                        fprintf(stderr, "--%s: Unexpected value.\n", argtab->arg_long);
+                                        return 0;
+                                }
+                                else
+                                {
+                                        rc = argtab->arg_handler(
+                                            cli_arg_val(argtab->arg_short, argtab->arg_long, argv[i]), args);
+                                        if (!rc)
+                                        {
+                                                return 0;
+                                        }
+                                }
+                        }
+                        else
+                        {
+                                if (i == argc - 1)
+                                {
+                                        if (argtab->arg_flags & ARG_NO_VALUE)
+                                        {
+                                                rc = argtab->arg_handler(argv[i], args);
+                                                if (!rc)
+                                                {
+                                                        return 0;
+                                                }
+                                        }
+                                        else
+                                        {
+                                                fprintf(stderr,
+                                                        "--%s: Expected "
+                                                        "argument value.\n",
+                                                        argtab->arg_long);
+                                                return 0;
+                                        }
+                                }
+                                else
+                                {
+                                        if (argtab->arg_flags & ARG_NO_VALUE)
+                                        {
+                                                rc = argtab->arg_handler(argv[i], args);
+                                                if (!rc)
+                                                {
+                                                        return 0;
+                                                }
+                                        }
+                                        else
+                                        {
+                                                i++;
+                                                rc = argtab->arg_handler(argv[i], args);
+                                                if (!rc)
+                                                {
+                                                        return 0;
+                                                }
+                                        }
+                                }
+                        }
+                        if (argtab->arg_short == 'h')
+                        {
+                                return 1;
+                        }
+                }
+                else
+                {
+                        fprintf(stderr, "%s: Unknown argument\n", argv[i]);
+                        return 0;
+                }
+        }
+
+        for (i = 0; i < _argtab_size; i++)
+        {
+                if (arg_passed[i] == 0 && !(_argtab[i].arg_flags & ARG_OPTIONAL))
+                {
+                        fprintf(stderr, "--%s: required.\n", _argtab[i].arg_long);
+                        return 0;
+                }
+        }
+        if (args->format == FORMAT_IPSET && strlen(args->set_name) > IPSET_NAME_MAX)
+        {
+                fprintf(stderr, "--set-name: not longer than %d symbols for ipset (with -tmp suffix).\n",
+                        IPSET_NAME_MAX);
+                return 0;
+        }
+        return 1;
+}
+
+#define REASON_REWRITE 0
+#define REASON_APPEND 1
+#define REASON_STDOUT 2
+#define REASON_CANCEL 3
+#define REASON_IO_ERROR 4
+
+static int ask_output_file_reason(char *file)
+{
+        int rc;
+        while (1)
+        {
+                rc = printf("File %s is not empty. Rewrite? [y[es]/n[o]/a[ppend]] ", file);
+                if (rc == -1)
+                {
+                        return REASON_IO_ERROR;
+                }
+                rc = getc(stdin);
+                if (rc == EOF)
+                {
+                        return REASON_IO_ERROR;
+                }
+                if (rc == 'y')
+                {
+                        return REASON_REWRITE;
+                }
+                else if (rc == 'n')
+                {
+                        return REASON_CANCEL;
+                }
+                else if (rc == 'a')
+                {
+                        return REASON_APPEND;
+                }
+                else
+                {
+                        // nothing to do invalid input
+                }
+        }
+        return REASON_CANCEL;
+}
+
+/*
+ * --report writer: aggregate() writes every label run into it as soon as
+ * run is aggregated. CSV with header or JSON lines.
+ */
+typedef struct
+{
+        out_t *out;
+        int json;
+        char **names; // label names in --label-column mode, else NULL
+} report_t;
+
+struct compress_stats
+{
+        size_t coverage;
+        size_t source_count;
+        int level; // level used by last aggregate_run()
+        set_limit_t limit;
+        dedup_t dedup;
+        report_t *report;
+};
+
+static void report_string(out_t *o, const char *s, int json)
+{
+        char e[8];
+        if (!json && !strpbrk(s, ",\"\r\n"))
+        {
+                out_puts(o, s);
+                return;
+        }
+        out_puts(o, "\"");
+        for (; *s; s++)
+        {
+                if (*s == '"')
+                {
+                        out_puts(o, json ? "\\\"" : "\"\"");
+                }
+                else if (json && *s == '\\')
+                {
+                        out_puts(o, "\\\\");
+                }
+                else if (json && (unsigned char)*s < 0x20)
+                {
+                        out_write(o, e, snprintf(e, sizeof(e), "\\u%04x", (unsigned char)*s));
+                }
+                else
+                {
+                        out_write(o, s, 1);
+                }
+        }
+        out_puts(o, "\"");
+}
+
+/*
+ * One line per subnet of aggregated run: prefix, count of source addresses,
+ * coverage, density (source / coverage) and level run was aggregated with.
+ */
+static void report_run(report_t *report, addr_list_t *head, int level)
+{
+        out_t *o = report->out;
+        addr_list_t *p;
+        size_t coverage;
+        uint64_t density;
+        char s[64];
+        int i;
+        for (p = head; p; p = p->next)
+        {
+                coverage = addr_v4_weight(p->addr.cidr);
+                out_puts(o, report->json ? "{" : "");
+                if (report->names)
+                {
+                        out_puts(o, report->json ? "\"label\":" : "");
+                        report_string(o, report->names[p->addr.label], report->json);
+                        out_puts(o, ",");
+                }
+                out_puts(o, report->json ? "\"prefix\":\"" : "");
+                out_write(o, s, addr_format_v4(s, &p->addr));
+                out_puts(o, p->addr.cidr == 32 ? "/32" : "");
+                out_puts(o, report->json ? "\",\"source\":" : ",");
+                out_size(o, p->count);
+                out_puts(o, report->json ? ",\"coverage\":" : ",");
+                out_size(o, coverage);
+                out_puts(o, report->json ? ",\"density\":" : ",");
+                // 6 decimal places without printf, it is most of report time
+                density = (uint64_t)((double)p->count / coverage * 1000000.0 + 0.5);
+                out_size(o, (size_t)(density / 1000000));
+                s[0] = '.';
+                for (i = 6, density %= 1000000; i > 0; i--, density /= 10)
+                {
+                        s[i] = '0' + density % 10;
+                }
+                out_write(o, s, 7);
+                out_puts(o, report->json ? ",\"level\":" : ",");
+                out_size(o, (size_t)level);
+                out_puts(o, report->json ? "}\n" : "\n");
+        }
+}
+
+/*
+ * compress() works on arrays of one label run. addr is contiguous, so run
+ * boundaries of a level are found by SIMD kernel: bit j of bounds is set if
+ * addr[j] differs from addr[j - 1] under mask. Bit 0 is set by caller.
+ */
+typedef struct
+{
+        uint32_t *addr;
+        uint8_t *cidr;
+        uint64_t *count;
+        uint64_t *bounds;
+        unsigned int label;
+} compress_buf_t;
+
+typedef void(compress_bounds_cb)(const uint32_t *addr, size_t n, uint32_t mask, uint64_t *bounds);
+
+static void compress_bounds_range(const uint32_t *addr, size_t j, size_t n, uint32_t mask, uint64_t *bounds)
+{
+        for (j = j ? j : 1; j < n; j++)
+        {
+                if ((addr[j] ^ addr[j - 1]) & mask)
+                {
+                        bounds[j >> 6] |= 1ULL << (j & 63);
+                }
+        }
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+__attribute__((target("avx2"))) static void compress_bounds_avx2(const uint32_t *addr, size_t n, uint32_t mask,
+                                                                 uint64_t *bounds)
+{
+        __m256i m = _mm256_set1_epi32((int)mask), zero = _mm256_setzero_si256(), x;
+        unsigned int eq;
+        size_t j;
+        compress_bounds_range(addr, 1, n < 8 ? n : 8, mask, bounds);
+        // 8 keys against 8 previous keys, 8 bits never cross bounds word
+        for (j = 8; j + 8 <= n; j += 8)
+        {
+                x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(addr + j)),
+                                     _mm256_loadu_si256((const __m256i *)(addr + j - 1)));
+                x = _mm256_cmpeq_epi32(_mm256_and_si256(x, m), zero);
+                eq = (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(x));
+                bounds[j >> 6] |= (uint64_t)(~eq & 0xff) << (j & 63);
+        }
+        compress_bounds_range(addr, j, n, mask, bounds);
+}
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+static void compress_bounds_sse2(const uint32_t *addr, size_t n, uint32_t mask, uint64_t *bounds)
+{
+        __m128i m = _mm_set1_epi32((int)mask), zero = _mm_setzero_si128(), x;
+        unsigned int eq;
+        size_t j;
+        compress_bounds_range(addr, 1, n < 4 ? n : 4, mask, bounds);
+        for (j = 4; j + 4 <= n; j += 4)
+        {
+                x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(addr + j)),
+                                  _mm_loadu_si128((const __m128i *)(addr + j - 1)));
+                x = _mm_cmpeq_epi32(_mm_and_si128(x, m), zero);
+                eq = (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(x));
+                bounds[j >> 6] |= (uint64_t)(~eq & 0xf) << (j & 63);
+        }
+        compress_bounds_range(addr, j, n, mask, bounds);
+}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+static void compress_bounds_neon(const uint32_t *addr, size_t n, uint32_t mask, uint64_t *bounds)
+{
+        static const uint32_t lane_bits[4] = {1, 2, 4, 8};
+        uint32x4_t m = vdupq_n_u32(mask), bits = vld1q_u32(lane_bits), x;
+        size_t j;
+        compress_bounds_range(addr, 1, n < 4 ? n : 4, mask, bounds);
+        for (j = 4; j + 4 <= n; j += 4)
+        {
+                x = vtstq_u32(veorq_u32(vld1q_u32(addr + j), vld1q_u32(addr + j - 1)), m);
+                bounds[j >> 6] |= (uint64_t)vaddvq_u32(vandq_u32(x, bits)) << (j & 63);
+        }
+        compress_bounds_range(addr, j, n, mask, bounds);
+}
+#else
+static void compress_bounds_scalar(const uint32_t *addr, size_t n, uint32_t mask, uint64_t *bounds)
+{
+        compress_bounds_range(addr, 1, n, mask, bounds);
+}
+#endif
+
+static compress_bounds_cb *compress_bounds_kernel(void)
+{
+#if defined(__GNUC__) && defined(__x86_64__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+                return compress_bounds_avx2;
+        }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+        return compress_bounds_sse2;
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+        return compress_bounds_neon;
+#else
+        return compress_bounds_scalar;
+#endif
+}
+
+/*
+ * First boundary at or after j, n if none.
+ */
+static inline size_t compress_next_bound(const uint64_t *bounds, size_t j, size_t n)
+{
+        uint64_t w;
+        if (j >= n)
+        {
+                return n;
+        }
+        w = bounds[j >> 6] & (~0ULL << (j & 63));
+        while (!w)
+        {
+                j = (j | 63) + 1;
+                if (j >= n)
+                {
+                        return n;
+                }
+                w = bounds[j >> 6];
+        }
+        return (j & ~(size_t)63) + ctz64(w);
+}
+
+/*
+ * Run [j, end) is kept by --prefer-old: every subnet of run is in old set
+ * and merged prefix is not.
+ */
+static int compress_keep(const addr_set_t *prefer, compress_buf_t *b, size_t j, size_t end, int cidr)
+{
+        addr_t addr = {b->addr[j], cidr, b->label};
+        if (set_find(prefer, &addr))
+        {
+                return 0;
+        }
+        for (; j < end; j++)
+        {
+                addr.addr = b->addr[j];
+                addr.cidr = b->cidr[j];
+                if (!set_find(prefer, &addr))
+                {
+                        return 0;
+                }
+        }
+        return 1;
+}
+
+/*
+ * One level of compress(): every run of 2 or more subnets equal under
+ * prefix i is merged into the prefix if sum of counts >= weight(i) >> level.
+ * Arrays are compacted in place, returns new length.
+ */
+static size_t compress_level(compress_buf_t *b, size_t n, int i, int level, const addr_set_t *prefer,
+                             compress_bounds_cb *kernel)
+{
+        uint32_t mask = i ? ~0U << (32 - i) : 0;
+        size_t j, k, end, out = 0;
+        uint64_t sum, cover;
+        memset(b->bounds, 0, ((n + 63) / 64) * sizeof(uint64_t));
+        b->bounds[0] = 1;
+        kernel(b->addr, n, mask, b->bounds);
+        for (j = 0; j < n; j = end)
+        {
+                // nothing merged so far and 64 single subnets in a row, the last is single only if next
+                // subnet starts own run
+                if (out == j && !(j & 63) && b->bounds[j >> 6] == ~0ULL && j + 64 <= n &&
+                    (j + 64 == n || (b->bounds[(j >> 6) + 1] & 1)))
+                {
+                        out = end = j + 64;
+                        continue;
+                }
+                end = compress_next_bound(b->bounds, j + 1, n);
+                if (end - j > 1)
+                {
+                        sum = cover = 0;
+                        for (k = j; k < end; k++)
+                        {
+                                sum += b->count[k];
+                                cover += addr_v4_weight(b->cidr[k]);
+                        }
+                        // --prefer-old: merge adding no false coverage is skipped if run is in old set as is
+                        if (sum >= (addr_v4_weight(i) >> level) &&
+                            !(prefer && cover == addr_v4_weight(i) && compress_keep(prefer, b, j, end, i)))
+                        {
+                                b->addr[out] = b->addr[j] & mask;
+                                b->cidr[out] = (uint8_t)i;
+                                b->count[out] = sum;
+                                out++;
+                                continue;
+                        }
+                }
+                if (out != j)
+                {
+                        memmove(b->addr + out, b->addr + j, (end - j) * sizeof(uint32_t));
+                        memmove(b->cidr + out, b->cidr + j, (end - j) * sizeof(uint8_t));
+                        memmove(b->count + out, b->count + j, (end - j) * sizeof(uint64_t));
+                }
+                out += end - j;
+        }
+        return out;
+}
+
+static void compress_buf_free(compress_buf_t *b)
+{
+        free(b->addr);
+        free(b->cidr);
+        free(b->count);
+        free(b->bounds);
+}
+
+/*
+ * Arrays for up to n subnets. Returns 0 if out of memory.
+ */
+static int compress_buf_alloc(compress_buf_t *b, size_t n)
+{
+        b->addr = malloc(n * sizeof(uint32_t));
+        b->cidr = malloc(n * sizeof(uint8_t));
+        b->count = malloc(n * sizeof(uint64_t));
+        b->bounds = malloc(((n + 63) / 64) * sizeof(uint64_t));
+        b->label = 0;
+        if (!b->addr || !b->cidr || !b->count || !b->bounds)
+        {
+                compress_buf_free(b);
+                return 0;
+        }
+        return 1;
+}
+
+/*
+ * Merge n subnets of arrays by levels from /31 to /0, returns new count.
+ */
+static size_t compress_buf_run(compress_buf_t *b, size_t n, int level, const addr_set_t *prefer)
+{
+        compress_bounds_cb *kernel = compress_bounds_kernel();
+        int i;
+        for (i = 31; i >= 0; i--)
+        {
+                n = compress_level(b, n, i, level, prefer, kernel);
+        }
+        return n;
+}
+
+/*
+ * Merge list by levels from /31 to /0. List is copied into arrays, merged
+ * level by level and written back into first nodes. Returns count of
+ * subnets or -1 if out of memory.
+ */
+static int compress(addr_list_t **head, addr_list_t **tail, int level, struct compress_stats *stats,
+                    const addr_set_t *prefer)
+{
+        compress_buf_t b;
+        addr_list_t *p, *next;
+        size_t n = 0, j;
+        stats->coverage = 0;
+        stats->source_count = 0;
+        for (p = *head; p; p = p->next)
+        {
+                n++;
+        }
+        if (n == 0)
+        {
+                return 0;
+        }
+        if (!compress_buf_alloc(&b, n))
+        {
+                return -1;
+        }
+        b.label = (*head)->addr.label;
+        for (p = *head, j = 0; p; p = p->next, j++)
+        {
+                b.addr[j] = p->addr.addr;
+                b.cidr[j] = (uint8_t)p->addr.cidr;
+                b.count[j] = p->count;
+        }
+        n = compress_buf_run(&b, n, level, prefer);
+        for (p = *head, j = 0; j < n; p = p->next, j++)
+        {
+                p->addr.addr = b.addr[j];
+                p->addr.cidr = b.cidr[j];
+                p->count = (size_t)b.count[j];
+                stats->coverage += addr_v4_weight(p->addr.cidr);
+                stats->source_count += p->count;
+        }
+        // nodes of merged subnets are not needed
+        *tail = p ? p->prev : *tail;
+        (*tail)->next = (void *)0;
+        for (; p; p = next)
+        {
+                next = p->next;
+                list_item_free(p);
+        }
+        compress_buf_free(&b);
+        return (int)n;
+}
+
+/*
+ * Compress list by level, or find lowest level with result not greater than
+ * --count. If prefer is not NULL, subnets of it are not merged when merge
+ * does not change coverage (--prefer-old). Returns count of subnets or -1 if
+ * out of memory.
+ */
+static int aggregate_run(addr_list_t **head, addr_list_t **tail, args_t *args, struct compress_stats *stats,
+                         const addr_set_t *prefer)
+{
+        addr_list_t *thead = (void *)0, *ttail = (void *)0;
+        int i, count = 0;
+        if (args->mode != MODE_COUNT)
+        {
+                stats->level = args->level;
+                return compress(head, tail, args->level, stats, prefer);
+        }
+        for (i = 0; i <= 32; i++)
+        {
+                if (!list_copy(*head, &thead, &ttail))
+                {
+                        list_free(&thead, &ttail);
+                        return -1;
+                }
+                count = compress(&thead, &ttail, i, stats, prefer);
+                if (count <= args->count)
+                {
+                        stats->level = i;
+                        list_free(head, tail);
+                        *head = thead;
+                        *tail = ttail;
+                        break;
+                }
+                list_free(&thead, &ttail);
+        }
+        return count;
+}
+
+/*
+ * Aggregate each label run of sorted list independently (whole list is one
+ * run without labels). Stats and count are summed over labels, every run is
+ * written into stats->report if set.
+ */
+static int aggregate(addr_list_t **head, addr_list_t **tail, args_t *args, struct compress_stats *stats,
+                     const addr_set_t *prefer)
+{
+        addr_list_t *rhead = *head, *rtail, *next, *ohead = (void *)0, *otail = (void *)0;
+        struct compress_stats run_stats;
+        int count, total = 0;
+        stats->coverage = 0;
+        stats->source_count = 0;
+        while (rhead)
+        {
+                rtail = rhead;
+                while (rtail->next && rtail->next->addr.label == rhead->addr.label)
+                {
+                        rtail = rtail->next;
+                }
+                next = rtail->next;
+                rtail->next = (void *)0;
+                if (next)
+                {
+                        next->prev = (void *)0;
+                }
+                run_stats.coverage = 0;
+                run_stats.source_count = 0;
+                run_stats.level = args->level;
+                count = aggregate_run(&rhead, &rtail, args, &run_stats, prefer);
+                if (otail)
+                {
+                        otail->next = rhead;
+                        rhead->prev = otail;
+                }
+                else
+                {
+                        ohead = rhead;
+                }
+                otail = rtail;
+                if (count < 0)
+                {
+                        // keep list whole for list_free(), runs after this are untouched
+                        if (next)
+                        {
+                                otail->next = next;
+                                next->prev = otail;
+                        }
+                        else
+                        {
+                                *tail = otail;
+                        }
+                        *head = ohead;
+                        return -1;
+                }
+                if (stats->report)
+                {
+                        report_run(stats->report, rhead, run_stats.level);
+                }
+                total += count;
+                stats->coverage += run_stats.coverage;
+                stats->source_count += run_stats.source_count;
+                stats->level = run_stats.level;
+                rhead = next;
+        }
+        *head = ohead;
+        *tail = otail;
+        return total;
+}
+
+static size_t aggregate_set_run(const addr_set_t *set, size_t start, size_t end, int level, compress_buf_t *b)
+{
+        size_t j;
+        for (j = start; j < end; j++)
+        {
+                b->addr[j - start] = set->items[j].addr.addr;
+                b->cidr[j - start] = (uint8_t)set->items[j].addr.cidr;
+                b->count[j - start] = set->items[j].count;
+        }
+        return compress_buf_run(b, end - start, level, (void *)0);
+}
+
+/*
+ * Lowest level giving not more than count subnets, same as --mode=count.
+ * Merge of prefix depends only on sum of its addresses, so bigger level
+ * merges at least the same prefixes and result does not grow: level is
+ * found by binary search.
+ */
+static int aggregate_set_level(const addr_set_t *set, size_t start, size_t end, int count, compress_buf_t *b)
+{
+        int lo = 0, hi = 32, mid;
+        while (lo < hi)
+        {
+                mid = (lo + hi) / 2;
+                if (aggregate_set_run(set, start, end, mid, b) <= (size_t)count)
+                {
+                        hi = mid;
+                }
+                else
+                {
+                        lo = mid + 1;
+                }
+        }
+        return lo;
+}
+
+/*
+ * aggregate() of sorted set without list: each label run is copied into
+ * arrays of compress() (again for every level tried by --count) and only
+ * result is appended to list. Set is only read, so it may be shared by
+ * threads. Returns count of subnets or -1 if out of memory.
+ */
+static int aggregate_set(const addr_set_t *set, args_t *args, struct compress_stats *stats, addr_list_t **head,
+                         addr_list_t **tail)
+{
+        compress_buf_t b;
+        addr_list_t *item;
+        size_t start, end, n, j;
+        int level, total = 0;
+        stats->coverage = 0;
+        stats->source_count = 0;
+        if (set->len == 0)
+        {
+                return 0;
+        }
+        if (!compress_buf_alloc(&b, set->len))
+        {
+                return -1;
+        }
+        for (start = 0; start < set->len; start = end)
+        {
+                for (end = start + 1; end < set->len && set->items[end].addr.label == set->items[start].addr.label;
+                     end++)
+                {
+                }
+                b.label = set->items[start].addr.label;
+                level = args->mode == MODE_COUNT ? aggregate_set_level(set, start, end, args->count, &b) : args->level;
+                n = aggregate_set_run(set, start, end, level, &b);
+                for (j = 0; j < n; j++)
+                {
+                        item = list_item_alloc();
+                        if (!item)
+                        {
+                                compress_buf_free(&b);
+                                return -1;
+                        }
+                        item->addr.addr = b.addr[j];
+                        item->addr.cidr = b.cidr[j];
+                        item->addr.label = b.label;
+                        item->count = (size_t)b.count[j];
+                        item->prev = *tail;
+                        if (*tail)
+                        {
+                                (*tail)->next = item;
+                        }
+                        else
+                        {
+                                *head = item;
+                        }
+                        *tail = item;
+                        stats->coverage += addr_v4_weight(item->addr.cidr);
+                        stats->source_count += item->count;
+                }
+                total += (int)n;
+        }
+        compress_buf_free(&b);
+        return total;
+}
+
+/*
+ * Statistics of parsing: duplicates and --max-memory pre-aggregation.
+ */
+static void print_input_stats(FILE *o, struct compress_stats *stats)
+{
+        if (stats->dedup.duplicates > 0)
+        {
+                fprintf(o, "input: parsed=%zu, duplicates=%zu\n", stats->dedup.total, stats->dedup.duplicates);
+        }
+        if (stats->limit.collapses > 0 && stats->limit.cidr <= 32)
+        {
+                fprintf(o, "max-memory: pre-aggregated to /%d at level=%d\n", stats->limit.cidr,
+                        stats->limit.used_level);
+        }
+}
+
+static void print_faults(FILE *o)
+{
+        long minor, major;
+        if (page_faults(&minor, &major))
+        {
+                fprintf(o, "page-faults: minor=%ld, major=%ld\n", minor, major);
+        }
+}
+
+static void print_stats(FILE *o, struct compress_stats *stats, int count)
+{
+        fprintf(o,
+                "coverage=%zu, source=%zu, falsely_covered=%lf%%; "
+                "result=%d, "
+                "compress=%lf%%\n",
+                stats->coverage, stats->source_count,
+                100.00f - ((double)stats->source_count / stats->coverage * 100.00f), count,
+                100.00f - ((double)count / stats->source_count * 100.00f));
+        print_input_stats(o, stats);
+}
+
+#define ESTIMATE_LEVELS 33
+
+/*
+ * Estimated subnets and coverage of a part of result: expected value and
+ * bounds.
+ */
+typedef struct
+{
+        double count, count_min, count_max;
+        double coverage, coverage_min, coverage_max;
+} estimate_val_t;
+
+static void estimate_val_add(estimate_val_t *acc, const estimate_val_t *v)
+{
+        acc->count += v->count;
+        acc->count_min += v->count_min;
+        acc->count_max += v->count_max;
+        acc->coverage += v->coverage;
+        acc->coverage_min += v->coverage_min;
+        acc->coverage_max += v->coverage_max;
+}
+
+/*
+ * Result inside /24 with k addresses for every k, if addresses are placed
+ * uniformly (expected value) or in the best and the worst way (bounds).
+ * Block of size 2^b is split into halves by hypergeometric distribution and
+ * merged by the rule of compress(): sum >= 2^b >> level and 2 or more
+ * subnets in run, so block with one empty half is the other half. Levels
+ * from 8 give the same table.
+ */
+static void estimate_leaf(int level, double (*binom)[257], estimate_val_t *leaf)
+{
+        estimate_val_t row[2][257], v, *prev = row[0], *cur = row[1], *t;
+        size_t b, j, j1, size, half;
+        int merged;
+        double p;
+        memset(row, 0, sizeof(row));
+        prev[1].count = prev[1].count_min = prev[1].count_max = 1;
+        prev[1].coverage = prev[1].coverage_min = prev[1].coverage_max = 1;
+        for (b = 1; b <= 8; b++)
+        {
+                size = (size_t)1 << b;
+                half = size / 2;
+                for (j = 0; j <= size; j++)
+                {
+                        merged = j >= 2 && j >= (size >> level);
+                        memset(&cur[j], 0, sizeof(estimate_val_t));
+                        cur[j].count_min = cur[j].coverage_min = 1e300;
+                        for (j1 = j > half ? j - half : 0; j1 <= j && j1 <= half; j1++)
+                        {
+                                p = binom[half][j1] * binom[half][j - j1] / binom[size][j];
+                                if (merged && j1 != 0 && j1 != j)
+                                {
+                                        v.count = v.count_min = v.count_max = 1;
+                                        v.coverage = v.coverage_min = v.coverage_max = (double)size;
+                                }
+                                else if (merged)
+                                {
+                                        v = prev[j];
+                                }
+                                else
+                                {
+                                        v = prev[j1];
+                                        estimate_val_add(&v, &prev[j - j1]);
+                                }
+                                cur[j].count += p * v.count;
+                                cur[j].coverage += p * v.coverage;
+                                cur[j].count_min = v.count_min < cur[j].count_min ? v.count_min : cur[j].count_min;
+                                cur[j].count_max = v.count_max > cur[j].count_max ? v.count_max : cur[j].count_max;
+                                cur[j].coverage_min =
+                                    v.coverage_min < cur[j].coverage_min ? v.coverage_min : cur[j].coverage_min;
+                                cur[j].coverage_max =
+                                    v.coverage_max > cur[j].coverage_max ? v.coverage_max : cur[j].coverage_max;
+                        }
+                }
+                t = prev;
+                prev = cur;
+                cur = t;
+        }
+        memcpy(leaf, prev, 257 * sizeof(estimate_val_t));
+        // saturated /24 is 255 or 256 addresses
+        leaf[255].count = leaf[256].count;
+        leaf[255].coverage = leaf[256].coverage;
+        leaf[255].count_min = leaf[256].count_min < prev[255].count_min ? leaf[256].count_min : prev[255].count_min;
+        leaf[255].count_max = leaf[256].count_max > prev[255].count_max ? leaf[256].count_max : prev[255].count_max;
+        leaf[255].coverage_min =
+            leaf[256].coverage_min < prev[255].coverage_min ? leaf[256].coverage_min : prev[255].coverage_min;
+        leaf[255].coverage_max =
+            leaf[256].coverage_max > prev[255].coverage_max ? leaf[256].coverage_max : prev[255].coverage_max;
+}
+
+/*
+ * Walk tree of sums (heap: children of n are 2n and 2n + 1) from node n at
+ * prefix down to prefix bottom. Merge of a node depends only on sum of its
+ * addresses, so merged nodes are counted exactly. Nodes at bottom are added
+ * from leaf table (/24 tree of one /16) or, walking from /0 without leaf
+ * table, marked in free bits of level (/16 not covered by merged node).
+ */
+static void estimate_walk(const uint64_t *sums, size_t n, int prefix, int bottom, int level,
+                          const estimate_val_t *leaf, estimate_val_t *acc, uint64_t *unmerged)
+{
+        uint64_t size = addr_v4_weight(prefix);
+        while (sums[n])
+        {
+                if (prefix == bottom)
+                {
+                        if (leaf)
+                        {
+                                estimate_val_add(acc, &leaf[sums[n] > 255 ? 255 : sums[n]]);
+                        }
+                        else
+                        {
+                                unmerged[n - ((size_t)1 << bottom)] |= 1ULL << level;
+                        }
+                        return;
+                }
+                if (sums[n] >= 2 && sums[n] >= (size >> level))
+                {
+                        if (sums[2 * n] && sums[2 * n + 1])
+                        {
+                                acc->count += 1;
+                                acc->count_min += 1;
+                                acc->count_max += 1;
+                                acc->coverage += (double)size;
+                                acc->coverage_min += (double)size;
+                                acc->coverage_max += (double)size;
+                                return;
+                        }
+                        // run of one half is not merged, result is this half
+                        n = sums[2 * n] ? 2 * n : 2 * n + 1;
+                }
+                else
+                {
+                        estimate_walk(sums, 2 * n, prefix + 1, bottom, level, leaf, acc, unmerged);
+                        n = 2 * n + 1;
+                }
+                prefix++;
+                size >>= 1;
+        }
+}
+
+/*
+ * Result of every level from histograms: tree above /16 is walked once per
+ * level, then /24 tree of each /16 not covered by merged node. Returns 0 if
+ * out of memory.
+ */
+static int estimate_levels(const estimate_t *est, estimate_val_t *acc)
+{
+        estimate_val_t(*leaf)[257] = malloc(9 * sizeof(*leaf));
+        double(*binom)[257] = malloc(257 * sizeof(*binom));
+        uint64_t *sums = malloc(2 * 65536 * sizeof(uint64_t)), *unmerged = calloc(65536, sizeof(uint64_t));
+        uint64_t local[512];
+        size_t i, j, q;
+        int level, ok = leaf && binom && sums && unmerged;
+        for (i = 0; ok && i <= 256; i++)
+        {
+                binom[i][0] = 1;
+                for (j = 1; j <= 256; j++)
+                {
+                        binom[i][j] = i ? binom[i - 1][j - 1] + binom[i - 1][j] : 0;
+                }
+        }
+        for (level = 0; ok && level <= 8; level++)
+        {
+                estimate_leaf(level, binom, leaf[level]);
+        }
+        for (i = 0; ok && i < 65536; i++)
+        {
+                sums[65536 + i] = est->hist16[i];
+        }
+        for (i = 65535; ok && i > 0; i--)
+        {
+                sums[i] = sums[2 * i] + sums[2 * i + 1];
+        }
+        for (level = 0; ok && level < ESTIMATE_LEVELS; level++)
+        {
+                memset(&acc[level], 0, sizeof(estimate_val_t));
+                estimate_walk(sums, 1, 0, 16, level, (void *)0, &acc[level], unmerged);
+        }
+        for (q = 0; ok && q < 65536; q++)
+        {
+                if (!unmerged[q])
+                {
+                        continue;
+                }
+                for (i = 0; i < 256; i++)
+                {
+                        local[256 + i] = est->hist24[(q << 8) | i];
+                        local[256 + i] += local[256 + i] == 255;
+                }
+                for (i = 255; i > 1; i--)
+                {
+                        local[i] = local[2 * i] + local[2 * i + 1];
+                }
+                local[1] = est->hist16[q];
+                for (level = 0; level < ESTIMATE_LEVELS; level++)
+                {
+                        if (unmerged[q] & (1ULL << level))
+                        {
+                                estimate_walk(local, 1, 16, 24, level, leaf[level < 8 ? level : 8], &acc[level],
+                                              (void *)0);
+                        }
+                }
+        }
+        free(leaf);
+        free(binom);
+        free(sums);
+        free(unmerged);
+        return ok;
+}
+
+/*
+ * --estimate: one pass over inputs into histograms and approximate result of
+ * every level (and level of --count) with bounds. Addresses are not sorted
+ * and not deduplicated, repeated address is counted as another one.
+ */
+static int estimate_main(args_t *args)
+{
+        estimate_t est = {0};
+        ingest_opts_t opts = {(void *)0, args->extract, (void *)0, 0, -1, (void *)0, &est};
+        estimate_val_t acc[ESTIMATE_LEVELS];
+        addr_set_t set = {0};
+        size_t i, blocks16 = 0, blocks24 = 0, saturated = 0;
+        int level, found[3], ok = 0;
+        char err[512];
+        est.hist24 = calloc((size_t)1 << 24, 1);
+        est.hist16 = calloc(65536, sizeof(uint64_t));
+        if (est.hist24 && est.hist16)
+        {
+                ok = 1;
+                for (i = 0; ok && i < (size_t)args->input_count; i++)
+                {
+                        ok = load_input(args->input[i], &set, &opts, err, sizeof(err));
+                }
+                if (!ok)
+                {
+                        fprintf(stderr, "%s\n", err);
+                }
+        }
+        else
+        {
+                fprintf(stderr, "Cannot allocate memory.\n");
+        }
+        if (ok && !estimate_levels(&est, acc))
+        {
+                fprintf(stderr, "Cannot allocate memory.\n");
+                ok = 0;
+        }
+        for (i = 0; ok && i < ((size_t)1 << 24); i++)
+        {
+                blocks16 += i < 65536 && est.hist16[i];
+                blocks24 += est.hist24[i] != 0;
+                saturated += est.hist24[i] == 255;
+        }
+        if (ok)
+        {
+                fprintf(stdout, "estimate: source=%llu, /16=%zu, /24=%zu, saturated /24=%zu\n",
+                        (unsigned long long)est.source, blocks16, blocks24, saturated);
+                for (level = 0; level < ESTIMATE_LEVELS; level++)
+                {
+                        fprintf(stdout,
+                                "level=%d, subnets=%.0lf (%.0lf..%.0lf), coverage=%.0lf (%.0lf..%.0lf), "
+                                "falsely_covered=%lf%%\n",
+                                level, acc[level].count, acc[level].count_min, acc[level].count_max,
+                                acc[level].coverage, acc[level].coverage_min, acc[level].coverage_max,
+                                100.00f - ((double)est.source / acc[level].coverage * 100.00f));
+                }
+        }
+        if (ok && args->mode == MODE_COUNT)
+        {
+                // lowest level for expected, the best and the worst placement
+                found[0] = found[1] = found[2] = ESTIMATE_LEVELS - 1;
+                for (level = ESTIMATE_LEVELS - 1; level >= 0; level--)
+                {
+                        found[0] = acc[level].count < args->count + 0.5 ? level : found[0];
+                        found[1] = acc[level].count_min <= args->count ? level : found[1];
+                        found[2] = acc[level].count_max <= args->count ? level : found[2];
+                }
+                fprintf(stdout, "count=%d: level=%d (%d..%d)\n", args->count, found[0], found[1], found[2]);
+        }
+        set_free(&set);
+        free(est.hist24);
+        free(est.hist16);
+        return ok;
+}
+
+/*
+ * Batch emitters: one header, elements, one footer. ipset and nft output
+ * is loaded atomically (ipset through swap of temporary set, nft file is
+ * one transaction).
+ */
+static void emit_header(out_t *o, args_t *args, size_t total)
+{
+        switch (args->format)
+        {
+        case FORMAT_IPSET:
+                out_puts(o, "create ");
+                out_puts(o, args->set_name);
+                out_puts(o, " hash:net family inet hashsize 1024 maxelem ");
+                out_size(o, total > 65536 ? total : 65536);
+                out_puts(o, " -exist\ncreate ");
+                out_puts(o, args->set_name);
+                out_puts(o, "-tmp hash:net family inet hashsize 1024 maxelem ");
+                out_size(o, total > 65536 ? total : 65536);
+                out_puts(o, " -exist\nflush ");
+                out_puts(o, args->set_name);
+                out_puts(o, "-tmp\n");
+                break;
+        case FORMAT_NFT:
+                out_puts(o, "add table inet ");
+                out_puts(o, args->table);
+                out_puts(o, "\nadd set inet ");
+                out_puts(o, args->table);
+                out_puts(o, " ");
+                out_puts(o, args->set_name);
+                out_puts(o, " { type ipv4_addr; flags interval; }\nflush set inet ");
+                out_puts(o, args->table);
+                out_puts(o, " ");
+                out_puts(o, args->set_name);
+                out_puts(o, "\n");
+                break;
+        case FORMAT_BIRD:
+                out_puts(o, "protocol static ");
+                out_puts(o, args->set_name);
+                out_puts(o, " {\n\tipv4;\n");
+                break;
+        }
+}
+
+static void emit_addr(out_t *o, args_t *args, addr_t *addr, size_t i)
+{
+        switch (args->format)
+        {
+        case FORMAT_TEXT:
+                out_puts(o, args->prefix);
+                out_addr_v4(o, addr);
+                out_puts(o, args->postfix);
+                break;
+        case FORMAT_IPSET:
+                out_puts(o, "add ");
+                out_puts(o, args->set_name);
+                out_puts(o, "-tmp ");
+                out_addr_v4(o, addr);
+                out_puts(o, "\n");
+                break;
+        case FORMAT_NFT:
+                if (i % args->chunk_size == 0)
+                {
+                        if (i > 0)
+                        {
+                                out_puts(o, " }\n");
+                        }
+                        out_puts(o, "add element inet ");
+                        out_puts(o, args->table);
+                        out_puts(o, " ");
+                        out_puts(o, args->set_name);
+                        out_puts(o, " { ");
+                }
+                else
+                {
+                        out_puts(o, ", ");
+                }
+                out_addr_v4(o, addr);
+                break;
+        case FORMAT_IP_BATCH:
+                // route type goes before prefix in ip route syntax
+                out_puts(o, "route replace ");
+                if (strcmp(args->route_args, "blackhole") == 0)
+                {
+                        out_puts(o, "blackhole ");
+                        out_addr_v4(o, addr);
+                }
+                else
+                {
+                        out_addr_v4(o, addr);
+                        out_puts(o, " ");
+                        out_puts(o, args->route_args);
+                }
+                out_puts(o, "\n");
+                break;
+        case FORMAT_BIRD:
+                out_puts(o, "\troute ");
+                out_addr_v4(o, addr);
+                // bird requires prefix length for host routes too
+                if (addr->cidr == 32)
+                {
+                        out_puts(o, "/32");
+                }
+                out_puts(o, " ");
+                out_puts(o, args->route_args);
+                out_puts(o, ";\n");
+                break;
+        }
+}
+
+static void emit_footer(out_t *o, args_t *args, size_t total)
+{
+        switch (args->format)
+        {
+        case FORMAT_IPSET:
+                out_puts(o, "swap ");
+                out_puts(o, args->set_name);
+                out_puts(o, "-tmp ");
+                out_puts(o, args->set_name);
+                out_puts(o, "\ndestroy ");
+                out_puts(o, args->set_name);
+                out_puts(o, "-tmp\n");
+                break;
+        case FORMAT_NFT:
+                if (total > 0)
+                {
+                        out_puts(o, " }\n");
+                }
+                break;
+        case FORMAT_BIRD:
+                out_puts(o, "}\n");
+                break;
+        }
+}
+
+/*
+ * Subnet of lpm-table as address range, value is label id.
+ */
+typedef struct
+{
+        uint32_t first, last, value, cidr;
+} lpm_prefix_t;
+
+static int lpm_prefix_cmp(const void *a, const void *b)
+{
+        const lpm_prefix_t *x = a, *y = b;
+        if (x->first != y->first)
+        {
+                return x->first < y->first ? -1 : 1;
+        }
+        if (x->cidr != y->cidr)
+        {
+                return x->cidr < y->cidr ? -1 : 1;
+        }
+        return x->value < y->value ? -1 : x->value > y->value;
+}
+
+/*
+ * Append range to table, joined with previous one if adjacent with the same
+ * value.
+ */
+static void lpm_emit(uint32_t *first, uint32_t *last, uint32_t *value, size_t *count, uint64_t from, uint64_t to,
+                     uint32_t v)
+{
+        if (*count > 0 && (uint64_t)last[*count - 1] + 1 == from && value[*count - 1] == v)
+        {
+                last[*count - 1] = (uint32_t)to;
+                return;
+        }
+        first[*count] = (uint32_t)from;
+        last[*count] = (uint32_t)to;
+        value[*count] = v;
+        (*count)++;
+}
+
+/*
+ * Cut prefixes into disjoint ranges: prefixes sorted by start (bigger
+ * first) are either nested or disjoint, so open prefixes are a stack and
+ * address belongs to innermost one. Equal prefixes of several labels keep
+ * the last label. Returns count of ranges, arrays must fit 2n + 1.
+ */
+static size_t lpm_ranges(lpm_prefix_t *prefixes, size_t n, uint32_t *first, uint32_t *last, uint32_t *value)
+{
+        lpm_prefix_t stack[33];
+        size_t i, depth = 0, count = 0;
+        uint64_t cur = 0;
+        qsort(prefixes, n, sizeof(lpm_prefix_t), lpm_prefix_cmp);
+        for (i = 0; i <= n; i++)
+        {
+                while (depth > 0 && (i == n || stack[depth - 1].last < prefixes[i].first))
+                {
+                        depth--;
+                        if (cur <= stack[depth].last)
+                        {
+                                lpm_emit(first, last, value, &count, cur, stack[depth].last, stack[depth].value);
+                                cur = (uint64_t)stack[depth].last + 1;
+                        }
+                }
+                if (i == n)
+                {
+                        break;
+                }
+                if (depth > 0 && cur < prefixes[i].first)
+                {
+                        lpm_emit(first, last, value, &count, cur, prefixes[i].first - 1ULL, stack[depth - 1].value);
+                }
+                cur = cur > prefixes[i].first ? cur : prefixes[i].first;
+                if (depth > 0 && stack[depth - 1].first == prefixes[i].first &&
+                    stack[depth - 1].cidr == prefixes[i].cidr)
+                {
+                        depth--;
+                }
+                stack[depth++] = prefixes[i];
+        }
+        return count;
+}
+
+/*
+ * --output-format=lpm-table: longest prefix match table of
+ * include/cidrips_lpm.h, values are labels (names are written if labels is
+ * not NULL). Returns errno value or 0.
+ */
+static int write_lpm(FILE *f, addr_list_t *head, addr_list_t *end, labels_t *labels)
+{
+        cidrips_lpm_header_t h;
+        lpm_prefix_t *prefixes;
+        addr_list_t *p;
+        uint32_t *data, *first, *last, *value, *label;
+        size_t n = 0, count, i, q, label_count = labels ? labels->count : 0, names_size = 0, size;
+        char *names;
+        int err = 0;
+#ifdef _WIN32
+        _setmode(_fileno(f), _O_BINARY);
+#endif
+        for (p = head; p != end; p = p->next)
+        {
+                n++;
+        }
+        for (i = 0; i < label_count; i++)
+        {
+                names_size += strlen(labels->names[i]) + 1;
+        }
+        prefixes = malloc((n ? n : 1) * sizeof(lpm_prefix_t));
+        // index, first, last, value, label offsets, then names
+        data = malloc((CIDRIPS_LPM_INDEX_SIZE + 3 * (2 * n + 1) + label_count) * sizeof(uint32_t) + names_size);
+        if (!prefixes || !data)
+        {
+                free(prefixes);
+                free(data);
+                return ENOMEM;
+        }
+        for (p = head, i = 0; p != end; p = p->next, i++)
+        {
+                prefixes[i].cidr = (uint32_t)p->addr.cidr;
+                prefixes[i].first = p->addr.cidr ? p->addr.addr & (~0U << (32 - p->addr.cidr)) : 0;
+                prefixes[i].last = prefixes[i].first + (uint32_t)(addr_v4_weight(p->addr.cidr) - 1);
+                prefixes[i].value = p->addr.label;
+        }
+        first = data + CIDRIPS_LPM_INDEX_SIZE;
+        last = first + 2 * n + 1;
+        value = last + 2 * n + 1;
+        count = lpm_ranges(prefixes, n, first, last, value);
+        free(prefixes);
+        // ranges are packed after index
+        memmove(first + count, last, count * sizeof(uint32_t));
+        last = first + count;
+        memmove(last + count, value, count * sizeof(uint32_t));
+        value = last + count;
+        for (q = 0, i = 0; q < CIDRIPS_LPM_INDEX_SIZE - 1; q++)
+        {
+                while (i < count && last[i] < (uint32_t)(q << 16))
+                {
+                        i++;
+                }
+                data[q] = (uint32_t)i;
+        }
+        data[CIDRIPS_LPM_INDEX_SIZE - 1] = (uint32_t)count;
+        label = value + count;
+        names = (char *)(label + label_count);
+        for (i = 0, size = 0; i < label_count; i++)
+        {
+                label[i] = (uint32_t)size;
+                memcpy(names + size, labels->names[i], strlen(labels->names[i]) + 1);
+                size += strlen(labels->names[i]) + 1;
+        }
+        size = (char *)(names + names_size) - (char *)data;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, CIDRIPS_LPM_MAGIC, 8);
+        h.version = CIDRIPS_LPM_VERSION;
+        h.byte_order = 0x01020304;
+        h.range_count = (uint32_t)count;
+        h.label_count = (uint32_t)label_count;
+        h.index_offset = sizeof(h);
+        h.first_offset = h.index_offset + CIDRIPS_LPM_INDEX_SIZE * sizeof(uint32_t);
+        h.last_offset = h.first_offset + count * sizeof(uint32_t);
+        h.value_offset = h.last_offset + count * sizeof(uint32_t);
+        h.label_offset = h.value_offset + count * sizeof(uint32_t);
+        h.names_offset = h.label_offset + label_count * sizeof(uint32_t);
+        h.file_size = sizeof(h) + size;
+        h.checksum = cidrips_lpm_checksum(0xcbf29ce484222325ULL, data, size);
+        if (fwrite(&h, sizeof(h), 1, f) != 1 || fwrite(data, 1, size, f) != size || fflush(f) != 0)
+        {
+                err = errno ? errno : EIO;
+        }
+        free(data);
+        return err;
+}
+
+/*
+ * Write subnets from head until end (NULL for whole list). Text output puts
+ * label (if not NULL) before each subnet.
+ */
+static int write_result(FILE *f, args_t *args, addr_list_t *head, addr_list_t *end, const char *label)
+{
+        out_t *o;
+        addr_list_t *p;
+        size_t i, total = 0;
+        int err;
+        if (args->format == FORMAT_LPM)
+        {
+                return write_lpm(f, head, end, (void *)0);
+        }
+        o = malloc(sizeof(out_t));
+        if (!o)
+        {
+                return ENOMEM;
+        }
+        o->f = f;
+        o->len = 0;
+        o->err = 0;
+        for (p = head; p != end; p = p->next)
+        {
+                total++;
+        }
+        emit_header(o, args, total);
+        for (p = head, i = 0; p != end; p = p->next, i++)
+        {
+                if (label && args->format == FORMAT_TEXT)
+                {
+                        out_puts(o, label);
+                        out_puts(o, " ");
+                }
+                emit_addr(o, args, &p->addr, i);
+        }
+        emit_footer(o, args, total);
+        out_flush(o);
+        err = o->err;
+        free(o);
+        return err;
+}
+
+typedef struct
+{
+        FILE *f;
+        char path[1024];
+        char tmp[1040];
+} output_t;
+
+/*
+ * Open output file. Rewritten file is written beside as temporary and
+ * replaces output in output_close(), so readers never see empty or partial
+ * file. Appended file is written in place.
+ */
+static int output_open(output_t *out, const char *path, int append)
+{
+        snprintf(out->path, sizeof(out->path), "%s", path);
+        out->tmp[0] = '\0';
+        if (!append)
+        {
+                snprintf(out->tmp, sizeof(out->tmp), "%s.tmp", path);
+        }
+        out->f = fopen(append ? path : out->tmp, append ? "a" : "w");
+        return out->f != (void *)0;
+}
+
+/*
+ * Close output after write_result() returned err. Returns errno value of
+ * first error or 0, temporary file is removed on error.
+ */
+static int output_close(output_t *out, int err)
+{
+        if (fclose(out->f) != 0 && !err)
+        {
+                err = errno;
+        }
+        out->f = (void *)0;
+        if (!out->tmp[0])
+        {
+                return err;
+        }
+#ifdef _WIN32
+        // rename() does not replace existing file on windows
+        if (!err)
+        {
+                remove(out->path);
+        }
+#endif
+        if (!err && rename(out->tmp, out->path) != 0)
+        {
+                err = errno;
+        }
+        if (err)
+        {
+                remove(out->tmp);
+        }
+        return err;
+}
+
+/*
+ * Open --report file. Names of labels are taken as is, so labels must not
+ * be added until report_close().
+ */
+static int report_open(report_t *report, output_t *file, const char *path, labels_t *labels)
+{
+        size_t len = strlen(path);
+        report->json = (len > 5 && strcmp(path + len - 5, ".json") == 0) ||
+                       (len > 6 && strcmp(path + len - 6, ".jsonl") == 0);
+        report->names = labels && labels->column ? labels->names : (void *)0;
+        report->out = malloc(sizeof(out_t));
+        if (!report->out)
+        {
+                errno = ENOMEM;
+                return 0;
+        }
+        if (!output_open(file, path, 0))
+        {
+                free(report->out);
+                report->out = (void *)0;
+                return 0;
+        }
+        report->out->f = file->f;
+        report->out->len = 0;
+        report->out->err = 0;
+        if (!report->json)
+        {
+                out_puts(report->out, report->names ? "label," : "");
+                out_puts(report->out, "prefix,source,coverage,density,level\n");
+        }
+        return 1;
+}
+
+/*
+ * Flush and close report, file is not replaced if err is set (aggregation
+ * failed). Returns errno value of first error or 0.
+ */
+static int report_close(report_t *report, output_t *file, int err)
+{
+        out_flush(report->out);
+        if (!err)
+        {
+                err = report->out->err;
+        }
+        free(report->out);
+        report->out = (void *)0;
+        return output_close(file, err);
+}
+
+/*
+ * --diff-against: write subnets of sorted list missing in sorted old set
+ * (announce), then subnets of old set missing in list (withdraw). Both are
+ * ordered by addr_sort_key(), so it is one linear merge per pass. Returns
+ * errno value.
+ */
+static int write_diff(FILE *f, args_t *args, addr_list_t *head, const addr_set_t *old, size_t *announced,
+                      size_t *withdrawn)
+{
+        out_t *o = malloc(sizeof(out_t));
+        addr_list_t *p;
+        addr_t addr;
+        uint64_t key;
+        size_t j;
+        int pass, err;
+        if (!o)
+        {
+                return ENOMEM;
+        }
+        o->f = f;
+        o->len = 0;
+        o->err = 0;
+        *announced = *withdrawn = 0;
+        for (pass = 0; pass < 2; pass++)
+        {
+                for (p = head, j = 0; p || (pass && j < old->len);)
+                {
+                        key = p ? addr_sort_key(&p->addr) : UINT64_MAX;
+                        if (j < old->len && addr_sort_key(&old->items[j].addr) < key)
+                        {
+                                if (pass)
+                                {
+                                        addr = old->items[j].addr;
+                                        out_puts(o, args->withdraw_prefix);
+                                        out_addr_v4(o, &addr);
+                                        out_puts(o, args->postfix);
+                                        (*withdrawn)++;
+                                }
+                                j++;
+                                continue;
+                        }
+                        if (j == old->len || addr_sort_key(&old->items[j].addr) != key)
+                        {
+                                if (!pass)
+                                {
+                                        out_puts(o, args->announce_prefix);
+                                        out_addr_v4(o, &p->addr);
+                                        out_puts(o, args->postfix);
+                                        (*announced)++;
+                                }
+                        }
+                        else
+                        {
+                                j++;
+                        }
+                        p = p->next;
+                }
+        }
+        out_flush(o);
+        err = o->err;
+        free(o);
+        return err;
+}
+
+/*
+ * Label mode output: every label run is written as own set (ipset, nft,
+ * bird are named by label). With --label-output each label goes to own
+ * file, otherwise all labels go to f. Returns errno value, or -1 if error
+ * is already reported.
+ */
+static int write_labels(FILE *f, args_t *args, labels_t *labels, addr_list_t *head)
+{
+        args_t *label_args = malloc(sizeof(args_t));
+        addr_list_t *end;
+        const char *name;
+        char path[1024], file_label[256];
+        size_t i;
+        output_t out;
+        int rc = 0;
+        if (!label_args)
+        {
+                return ENOMEM;
+        }
+        // one table of all labels, label is value of prefix
+        if (args->format == FORMAT_LPM && !args->label_output[0])
+        {
+                free(label_args);
+                return write_lpm(f, head, (void *)0, labels);
+        }
+        *label_args = *args;
+        while (head && !rc)
+        {
+                for (end = head; end && end->addr.label == head->addr.label; end = end->next)
+                {
+                }
+                name = labels->names[head->addr.label];
+                if (args->format == FORMAT_IPSET && strlen(name) > IPSET_NAME_MAX)
+                {
+                        fprintf(stderr, "Label %s: not longer than %d symbols for ipset set name.\n", name,
+                                IPSET_NAME_MAX);
+                        rc = -1;
+                        break;
+                }
+                snprintf(label_args->set_name, sizeof(label_args->set_name), "%s", name);
+                if (!args->label_output[0])
+                {
+                        rc = write_result(f, label_args, head, end, name);
+                        head = end;
+                        continue;
+                }
+                // label must not escape from template directory
+                snprintf(file_label, sizeof(file_label), "%s", name);
+                for (i = 0; file_label[i]; i++)
+                {
+                        if (file_label[i] == '/' || file_label[i] == '\\' || file_label[i] == ':')
+                        {
+                                file_label[i] = '_';
+                        }
+                }
+                snprintf(path, sizeof(path), args->label_output, file_label);
+                if (!output_open(&out, path, args->append))
+                {
+                        fprintf(stderr, "Cannot open file: %s %s\n", path, strerror(errno));
+                        rc = -1;
+                        break;
+                }
+                rc = output_close(&out, write_result(out.f, label_args, head, end, (void *)0));
+                head = end;
+        }
+        free(label_args);
+        return rc;
+}
+
+static double time_now(void)
+{
+        struct timespec ts;
+        timespec_get(&ts, TIME_UTC);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cpu_count(void)
+{
+#ifdef HAVE_AFFINITY
+        if (affinity.count > 0)
+        {
+                return affinity.count;
+        }
+#endif
+#ifdef HAVE_PTHREAD
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        return n > 0 ? (int)n : 1;
+#else
+        return 1;
+#endif
+}
+
+typedef void(pool_task_cb)(void *ctx, size_t i);
+
+#ifdef HAVE_PTHREAD
+typedef struct
+{
+        pool_task_cb *cb;
+        void *ctx;
+        size_t n;
+        _Atomic size_t next;
+} pool_t;
+
+static void *pool_worker(void *arg)
+{
+        pool_t *pool = arg;
+        size_t i;
+        while ((i = atomic_fetch_add(&pool->next, 1)) < pool->n)
+        {
+                pool->cb(pool->ctx, i);
+        }
+        return (void *)0;
+}
+
+static void *pool_thread(void *arg)
+{
+        affinity_pin();
+        pool_worker(arg);
+        arena_release();
+        return (void *)0;
+}
+#endif
+
+/*
+ * Run tasks 0..n-1 on up to threads workers (calling thread is one of them),
+ * each worker takes next free task. Returns when all tasks done.
+ */
+static void pool_run(size_t n, pool_task_cb *cb, void *ctx, int threads)
+{
+        size_t i;
+#ifdef HAVE_PTHREAD
+        pthread_t *workers;
+        pool_t pool = {cb, ctx, n, 0};
+        int started = 0;
+        if (threads > 1 && n > 1)
+        {
+                if ((size_t)threads > n)
+                {
+                        threads = (int)n;
+                }
+                workers = malloc((threads - 1) * sizeof(pthread_t));
+                for (; workers && started < threads - 1; started++)
+                {
+                        if (pthread_create(&workers[started], (void *)0, pool_thread, &pool) != 0)
+                        {
+                                break;
+                        }
+                }
+                // calling thread works too, it also covers failed thread creation
+                pool_worker(&pool);
+                for (i = 0; i < (size_t)started; i++)
+                {
+                        pthread_join(workers[i], (void *)0);
+                }
+                free(workers);
+                return;
+        }
+#endif
+        for (i = 0; i < n; i++)
+        {
+                cb(ctx, i);
+        }
+}
+
+typedef struct
+{
+        char path[256];
+        int extract;
+        set_limit_t limit;
+        dedup_t dedup;
+        addr_set_t set;
+        int ok;
+        double seconds;
+        char error[512];
+} job_input_t;
+
+typedef struct
+{
+        args_t args;
+        int line;
+        int inputs[ARGS_MAX_INPUTS];
+        int ok;
+        int count;
+        struct compress_stats stats;
+        double seconds;
+        char error[512];
+} job_t;
+
+typedef struct
+{
+        job_t *jobs;
+        size_t jobs_count;
+        job_input_t *inputs;
+        size_t inputs_count;
+        size_t max_memory;
+} jobs_t;
+
+/*
+ * Split manifest line into arguments like shell does: whitespace separated,
+ * quotes group words and are removed. Modifies line.
+ */
+static int jobs_split_line(char *line, const char **argv, int max)
+{
+        int argc = 1;
+        char *p = line, *out;
+        char quote;
+        argv[0] = "cidrips";
+        while (*p)
+        {
+                while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+                {
+                        p++;
+                }
+                if (*p == '\0' || *p == '#')
+                {
+                        break;
+                }
+                if (argc == max)
+                {
+                        return -1;
+                }
+                argv[argc++] = out = p;
+                quote = 0;
+                while (*p)
+                {
+                        if (quote)
+                        {
+                                if (*p == quote)
+                                {
+                                        quote = 0;
+                                }
+                                else
+                                {
+                                        *out++ = *p;
+                                }
+                        }
+                        else if (*p == '"' || *p == '\'')
+                        {
+                                quote = *p;
+                        }
+                        else if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+                        {
+                                break;
+                        }
+                        else
+                        {
+                                *out++ = *p;
+                        }
+                        p++;
+                }
+                if (*p)
+                {
+                        p++;
+                }
+                *out = '\0';
+        }
+        return argc;
+}
+
+static int jobs_input_id(jobs_t *jobs, const char *path, int extract)
+{
+        size_t i;
+        job_input_t *inputs;
+        for (i = 0; i < jobs->inputs_count; i++)
+        {
+                if (strcmp(jobs->inputs[i].path, path) == 0 && jobs->inputs[i].extract == extract)
+                {
+                        return (int)i;
+                }
+        }
+        inputs = realloc(jobs->inputs, (jobs->inputs_count + 1) * sizeof(job_input_t));
+        if (!inputs)
+        {
+                return -1;
+        }
+        jobs->inputs = inputs;
+        memset(&inputs[i], 0, sizeof(job_input_t));
+        strcpy(inputs[i].path, path);
+        inputs[i].extract = extract;
+        jobs->inputs_count++;
+        return (int)i;
+}
+
+/*
+ * Read manifest. Every job starts with global arguments (output format,
+ * prefix, ...) and overrides them by own line.
+ */
+static int jobs_load(jobs_t *jobs, args_t *args)
+{
+        FILE *f = fopen(args->jobs, "r");
+        char line[4096];
+        const char *argv[128];
+        int argc, lineno = 0, i;
+        job_t *job;
+        if (!f)
+        {
+                fprintf(stderr, "Cannot open file: %s %s\n", args->jobs, strerror(errno));
+                return 0;
+        }
+        while (fgets(line, sizeof(line), f))
+        {
+                lineno++;
+                argc = jobs_split_line(line, argv, 128);
+                if (argc == 1)
+                {
+                        continue;
+                }
+                job = realloc(jobs->jobs, (jobs->jobs_count + 1) * sizeof(job_t));
+                if (!job)
+                {
+                        fprintf(stderr, "Cannot allocate memory.\n");
+                        fclose(f);
+                        return 0;
+                }
+                jobs->jobs = job;
+                job = &jobs->jobs[jobs->jobs_count];
+                memset(job, 0, sizeof(job_t));
+                job->line = lineno;
+                job->args = *args;
+                job->args.input_count = 0;
+                job->args.output[0] = '\0';
+                job->args.jobs[0] = '\0';
+                job->args.affinity[0] = '\0';
+                job->args.mode = MODE_UNKNOWN;
+                job->args.level = 0;
+                job->args.count = 0;
+                if (argc < 0 || !cli_parse(argc, argv, &job->args) || job->args.help || job->args.jobs[0] ||
+                    job->args.affinity[0])
+                {
+                        fprintf(stderr, "%s:%d: invalid job.\n", args->jobs, lineno);
+                        fclose(f);
+                        return 0;
+                }
+                if (job->args.label_column || job->args.snapshot[0] || job->args.save_snapshot[0] ||
+                    job->args.diff_against[0] || job->args.report[0] || job->args.estimate || job->args.variant_count)
+                {
+                        fprintf(stderr,
+                                "%s:%d: --label-column, --diff-against, --report, --estimate, --variant and snapshots "
+                                "are not supported in jobs.\n",
+                                args->jobs, lineno);
+                        fclose(f);
+                        return 0;
+                }
+                if (job->args.input_count == 0 || job->args.output[0] == '\0' ||
+                    strcmp(job->args.output, "-") == 0)
+                {
+                        fprintf(stderr, "%s:%d: job requires --input and --output file.\n", args->jobs, lineno);
+                        fclose(f);
+                        return 0;
+                }
+                for (i = 0; i < job->args.input_count; i++)
+                {
+                        job->inputs[i] = jobs_input_id(jobs, job->args.input[i], job->args.extract);
+                        if (job->inputs[i] < 0)
+                        {
+                                fprintf(stderr, "Cannot allocate memory.\n");
+                                fclose(f);
+                                return 0;
+                        }
+                }
+                jobs->jobs_count++;
+        }
+        fclose(f);
+        return 1;
+}
+
+static void jobs_parse_task(void *ctx, size_t i)
+{
+        jobs_t *jobs = ctx;
+        job_input_t *input = &jobs->inputs[i];
+        double start = time_now();
+        ingest_opts_t opts = {(void *)0, input->extract, (void *)0, 0, -1, (void *)0, (void *)0};
+        // input is shared by jobs of any level, collapse starts from lossless level 0
+        if (jobs->max_memory)
+        {
+                set_limit_init(&input->limit, jobs->max_memory, 0);
+                opts.limit = &input->limit;
+        }
+        opts.dedup = &input->dedup;
+        input->ok = load_input(input->path, &input->set, &opts, input->error, sizeof(input->error));
+        dedup_free(&input->dedup);
+        input->seconds = time_now() - start;
+}
+
+/*
+ * Aggregate one job. Parsed inputs are shared between jobs and only read
+ * here, several inputs are merged into private set.
+ */
+static void jobs_run_task(void *ctx, size_t i)
+{
+        jobs_t *jobs = ctx;
+        job_t *job = &jobs->jobs[i];
+        addr_set_t merged = {0};
+        const addr_set_t *set = &jobs->inputs[job->inputs[0]].set;
+        addr_list_t *head = (void *)0, *tail = (void *)0;
+        double start = time_now();
+        output_t out;
+        int k, rc;
+        for (k = 0; k < job->args.input_count; k++)
+        {
+                if (!jobs->inputs[job->inputs[k]].ok)
+                {
+                        snprintf(job->error, sizeof(job->error), "%s", jobs->inputs[job->inputs[k]].error);
+                        return;
+                }
+        }
+        if (job->args.input_count > 1)
+        {
+                for (k = 0; k < job->args.input_count; k++)
+                {
+                        set = &jobs->inputs[job->inputs[k]].set;
+                        if (!set_append(&merged, set->items, set->len))
+                        {
+                                set_free(&merged);
+                                snprintf(job->error, sizeof(job->error), "Cannot allocate memory.");
+                                return;
+                        }
+                }
+                if (!set_sort(&merged))
+                {
+                        set_free(&merged);
+                        snprintf(job->error, sizeof(job->error), "Cannot allocate memory.");
+                        return;
+                }
+                set = &merged;
+        }
+        rc = set_to_list(set, &head, &tail);
+        set_free(&merged);
+        if (rc)
+        {
+                job->count = aggregate(&head, &tail, &job->args, &job->stats, (void *)0);
+        }
+        if (!rc || job->count < 0)
+        {
+                list_free(&head, &tail);
+                snprintf(job->error, sizeof(job->error), "Cannot allocate memory.");
+                return;
+        }
+        if (!output_open(&out, job->args.output, job->args.append))
+        {
+                list_free(&head, &tail);
+                snprintf(job->error, sizeof(job->error), "Cannot open file: %s %s", job->args.output,
+                         strerror(errno));
+                return;
+        }
+        rc = output_close(&out, write_result(out.f, &job->args, head, (void *)0, (void *)0));
+        list_free(&head, &tail);
+        if (rc)
+        {
+                snprintf(job->error, sizeof(job->error), "I/O error: %s", strerror(rc));
+                return;
+        }
+        job->ok = 1;
+        job->seconds = time_now() - start;
+}
+
+static void json_string(FILE *o, const char *s)
+{
+        fputc('"', o);
+        for (; *s; s++)
+        {
+                if (*s == '"' || *s == '\\')
+                {
+                        fprintf(o, "\\%c", *s);
+                }
+                else if ((unsigned char)*s < 0x20)
+                {
+                        fprintf(o, "\\u%04x", (unsigned char)*s);
+                }
+                else
+                {
+                        fputc(*s, o);
+                }
+        }
+        fputc('"', o);
+}
+
+static void jobs_report(FILE *o, jobs_t *jobs, double seconds)
+{
+        size_t i;
+        int k;
+        job_t *job;
+        long minor, major;
+        fprintf(o, "{\"seconds\": %.3f,\n", seconds);
+        if (page_faults(&minor, &major))
+        {
+                fprintf(o, " \"page_faults\": {\"minor\": %ld, \"major\": %ld},\n", minor, major);
+        }
+        fprintf(o, " \"inputs\": [");
+        for (i = 0; i < jobs->inputs_count; i++)
+        {
+                fprintf(o, "%s\n  {\"path\": ", i ? "," : "");
+                json_string(o, jobs->inputs[i].path);
+                fprintf(o, ", \"status\": ");
+                json_string(o, jobs->inputs[i].ok ? "ok" : jobs->inputs[i].error);
+                fprintf(o, ", \"parsed\": %zu, \"duplicates\": %zu, \"entries\": %zu, \"seconds\": %.3f",
+                        jobs->inputs[i].dedup.total, jobs->inputs[i].dedup.duplicates, jobs->inputs[i].set.len,
+                        jobs->inputs[i].seconds);
+                if (jobs->inputs[i].limit.collapses > 0 && jobs->inputs[i].limit.cidr <= 32)
+                {
+                        fprintf(o, ", \"pre_aggregated\": {\"cidr\": %d, \"level\": %d}", jobs->inputs[i].limit.cidr,
+                                jobs->inputs[i].limit.used_level);
+                }
+                fprintf(o, "}");
+        }
+        fprintf(o, "],\n \"jobs\": [");
+        for (i = 0; i < jobs->jobs_count; i++)
+        {
+                job = &jobs->jobs[i];
+                fprintf(o, "%s\n  {\"line\": %d, \"inputs\": [", i ? "," : "", job->line);
+                for (k = 0; k < job->args.input_count; k++)
+                {
+                        fprintf(o, "%s", k ? ", " : "");
+                        json_string(o, job->args.input[k]);
+                }
+                fprintf(o, "], \"output\": ");
+                json_string(o, job->args.output);
+                // count mode finds level itself, it is printed with result
+                if (job->args.mode == MODE_COUNT)
+                {
+                        fprintf(o, ", \"mode\": \"count\", \"count\": %d, \"status\": ", job->args.count);
+                }
+                else
+                {
+                        fprintf(o, ", \"mode\": \"level\", \"level\": %d, \"status\": ", job->args.level);
+                }
+                json_string(o, job->ok ? "ok" : job->error);
+                if (job->ok && job->args.mode == MODE_COUNT)
+                {
+                        fprintf(o, ", \"level\": %d", job->stats.level);
+                }
+                if (job->ok)
+                {
+                        fprintf(o,
+                                ", \"coverage\": %zu, \"source\": %zu, \"falsely_covered\": %lf, \"result\": %d, "
+                                "\"compress\": %lf, \"seconds\": %.3f",
+                                job->stats.coverage, job->stats.source_count,
+                                100.00f - ((double)job->stats.source_count / job->stats.coverage * 100.00f),
+                                job->count, 100.00f - ((double)job->count / job->stats.source_count * 100.00f),
+                                job->seconds);
+                }
+                fprintf(o, "}");
+        }
+        fprintf(o, "]}\n");
+}
+
+/*
+ * --jobs: parse every distinct input once, then run all jobs on shared
+ * thread pool and print one JSON report.
+ */
+static int jobs_main(args_t *args)
+{
+        jobs_t jobs = {0};
+        size_t i;
+        int threads = args->threads > 0 ? args->threads : cpu_count();
+        int ok = 1;
+        double start = time_now();
+        jobs.max_memory = args->max_memory;
+        if (!jobs_load(&jobs, args))
+        {
+                ok = 0;
+        }
+        else
+        {
+                pool_run(jobs.inputs_count, jobs_parse_task, &jobs, threads);
+                pool_run(jobs.jobs_count, jobs_run_task, &jobs, threads);
+                for (i = 0; i < jobs.jobs_count; i++)
+                {
+                        if (!jobs.jobs[i].ok)
+                        {
+                                fprintf(stderr, "%s:%d: %s\n", args->jobs, jobs.jobs[i].line, jobs.jobs[i].error);
+                                ok = 0;
+                        }
+                }
+                if (!args->no_stats)
+                {
+                        jobs_report(stdout, &jobs, time_now() - start);
+                }
+        }
+        for (i = 0; i < jobs.inputs_count; i++)
+        {
+                set_free(&jobs.inputs[i].set);
+        }
+        free(jobs.inputs);
+        free(jobs.jobs);
+        return ok;
+}
+
+typedef struct
+{
+        args_t args;
+        struct compress_stats stats;
+        int count;
+        char error[512];
+} variant_run_t;
+
+typedef struct
+{
+        const addr_set_t *set;
+        labels_t *labels;
+        variant_run_t *runs;
+} variants_t;
+
+static void variants_task(void *ctx, size_t i)
+{
+        variants_t *variants = ctx;
+        variant_run_t *run = &variants->runs[i];
+        addr_list_t *head = (void *)0, *tail = (void *)0;
+        output_t out;
+        int rc;
+        run->count = aggregate_set(variants->set, &run->args, &run->stats, &head, &tail);
+        if (run->count < 0)
+        {
+                list_free(&head, &tail);
+                snprintf(run->error, sizeof(run->error), "Cannot allocate memory.");
+                return;
+        }
+        if (!output_open(&out, run->args.output, 0))
+        {
+                list_free(&head, &tail);
+                snprintf(run->error, sizeof(run->error), "Cannot open file: %s %s", run->args.output, strerror(errno));
+                return;
+        }
+        if (run->args.label_column)
+        {
+                rc = output_close(&out, write_labels(out.f, &run->args, variants->labels, head));
+        }
+        else
+        {
+                rc = output_close(&out, write_result(out.f, &run->args, head, (void *)0, (void *)0));
+        }
+        list_free(&head, &tail);
+        if (rc)
+        {
+                snprintf(run->error, sizeof(run->error), "%s%s", rc > 0 ? "I/O error: " : "not written",
+                         rc > 0 ? strerror(rc) : "");
+        }
+}
+
+/*
+ * --variant: every variant is aggregated from the same parsed set by
+ * aggregate_set() on own worker and written into own file. Returns 0 if any
+ * variant failed.
+ */
+static int variants_main(args_t *args, const addr_set_t *set, labels_t *labels, struct compress_stats *stats)
+{
+        variant_run_t *runs = calloc(args->variant_count, sizeof(variant_run_t));
+        variants_t variants = {set, labels, runs};
+        int i, ok = 1;
+        if (!runs)
+        {
+                fprintf(stderr, "Cannot allocate memory.\n");
+                return 0;
+        }
+        for (i = 0; i < args->variant_count; i++)
+        {
+                runs[i].args = *args;
+                runs[i].args.mode = args->variants[i].mode;
+                runs[i].args.level = args->variants[i].level;
+                runs[i].args.count = args->variants[i].count;
+                strcpy(runs[i].args.output, args->variants[i].output);
+        }
+        pool_run(args->variant_count, variants_task, &variants, args->threads > 0 ? args->threads : cpu_count());
+        for (i = 0; i < args->variant_count; i++)
+        {
+                if (runs[i].error[0])
+                {
+                        fprintf(stderr, "%s: %s\n", runs[i].args.output, runs[i].error);
+                        ok = 0;
+                }
+                else if (!args->no_stats)
+                {
+                        fprintf(stdout, "%s: ", runs[i].args.output);
+                        print_stats(stdout, &runs[i].stats, runs[i].count);
+                }
+        }
+        if (!args->no_stats)
+        {
+                print_input_stats(stdout, stats);
+                print_faults(stdout);
+        }
+        free(runs);
+        return ok;
+}
+
+/*
+ * Builder API (include/cidrips.h). Local buffer is deduplicated and sorted by
+ * its thread, then cut by shard: top bits of the last address, so shards are
+ * ordered ranges of sort key. Every piece is pushed into list of its shard by
+ * compare-and-swap. Finalize merges pieces of every shard on pool and joins
+ * shards in order.
+ */
+#define BUILDER_SHARD_BITS 6
+#define BUILDER_SHARDS (1 << BUILDER_SHARD_BITS)
+#define BUILDER_LOCAL_SIZE 65536
+#define BUILDER_DEDUP_SLOTS (1 << 20)
+
+typedef struct builder_segment
+{
+        addr_set_t set;
+        struct builder_segment *next;
+} builder_segment_t;
+
+struct cidrips_builder
+{
+#ifdef HAVE_PTHREAD
+        _Atomic(builder_segment_t *) shards[BUILDER_SHARDS];
+#else
+        builder_segment_t *shards[BUILDER_SHARDS];
+#endif
+        addr_set_t merged[BUILDER_SHARDS];
+        int ok[BUILDER_SHARDS];
+};
+
+struct cidrips_local
+{
+        cidrips_builder_t *builder;
+        addr_set_t buf;
+        dedup_t dedup;
+};
+
+static inline int builder_shard(const addr_t *addr)
+{
+        return (int)(addr_sort_key(addr) >> (38 - BUILDER_SHARD_BITS));
+}
+
+static void builder_push(cidrips_builder_t *builder, int shard, builder_segment_t *segment)
+{
+#ifdef HAVE_PTHREAD
+        segment->next = atomic_load_explicit(&builder->shards[shard], memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&builder->shards[shard], &segment->next, segment,
+                                                      memory_order_release, memory_order_relaxed))
+        {
+        }
+#else
+        segment->next = builder->shards[shard];
+        builder->shards[shard] = segment;
+#endif
+}
+
+static builder_segment_t *builder_take(cidrips_builder_t *builder, int shard)
+{
+#ifdef HAVE_PTHREAD
+        return atomic_exchange_explicit(&builder->shards[shard], (void *)0, memory_order_acquire);
+#else
+        builder_segment_t *list = builder->shards[shard];
+        builder->shards[shard] = (void *)0;
+        return list;
+#endif
+}
+
+/*
+ * Join all segments of shard and sort them, radix sort of whole shard is
+ * cheaper than merging thousands of small segments.
+ */
+static void builder_merge_task(void *ctx, size_t shard)
+{
+        cidrips_builder_t *builder = ctx;
+        builder_segment_t *list = builder_take(builder, (int)shard), *next;
+        addr_set_t *set = &builder->merged[shard];
+        size_t len = 0;
+        int ok;
+        for (next = list; next; next = next->next)
+        {
+                len += next->set.len;
+        }
+        ok = set_reserve(set, len);
+        for (; list; list = next)
+        {
+                next = list->next;
+                ok = ok && set_append(set, list->set.items, list->set.len);
+                set_free(&list->set);
+                free(list);
+        }
+        builder->ok[shard] = ok && set_sort(set);
+}
+
+cidrips_builder_t *cidrips_builder_new(void)
+{
+        return calloc(1, sizeof(cidrips_builder_t));
+}
+
+int cidrips_builder_finalize(cidrips_builder_t *builder, int level, size_t max_count, cidrips_subnet_t **subnets,
+                             size_t *count)
+{
+        addr_set_t set = {0};
+        addr_list_t *head = (void *)0, *tail = (void *)0, *p;
+        struct compress_stats stats = {0};
+        args_t args = {0};
+        size_t i;
+        int ok = 1, n = -1;
+        *subnets = (void *)0;
+        *count = 0;
+        pool_run(BUILDER_SHARDS, builder_merge_task, builder, cpu_count());
+        // shards are ordered ranges, joined they are sorted set
+        for (i = 0; i < BUILDER_SHARDS; i++)
+        {
+                ok = ok && builder->ok[i] && set_append(&set, builder->merged[i].items, builder->merged[i].len);
+                set_free(&builder->merged[i]);
+        }
+        args.mode = max_count ? MODE_COUNT : MODE_LEVEL;
+        args.level = level;
+        args.count = (int)(max_count < INT32_MAX ? max_count : INT32_MAX);
+        if (ok && set_to_list(&set, &head, &tail))
+        {
+                n = aggregate(&head, &tail, &args, &stats, (void *)0);
+        }
+        set_free(&set);
+        if (n > 0 && !(*subnets = malloc(n * sizeof(cidrips_subnet_t))))
+        {
+                n = -1;
+        }
+        for (p = head, i = 0; n > 0 && p; p = p->next, i++)
+        {
+                (*subnets)[i].addr = p->addr.addr;
+                (*subnets)[i].cidr = p->addr.cidr;
+                (*subnets)[i].count = p->count;
+        }
+        list_free(&head, &tail);
+        // chunks of caller thread are not kept between builders
+        arena_release();
+        *count = n > 0 ? (size_t)n : 0;
+        return n >= 0;
+}
+
+void cidrips_builder_free(cidrips_builder_t *builder)
+{
+        builder_segment_t *list, *next;
+        int i;
+        if (!builder)
+        {
+                return;
+        }
+        for (i = 0; i < BUILDER_SHARDS; i++)
+        {
+                for (list = builder_take(builder, i); list; list = next)
+                {
+                        next = list->next;
+                        set_free(&list->set);
+                        free(list);
+                }
+        }
+        free(builder);
+}
+
+cidrips_local_t *cidrips_local_new(cidrips_builder_t *builder)
+{
+        cidrips_local_t *local = calloc(1, sizeof(cidrips_local_t));
+        if (local)
+        {
+                local->builder = builder;
+        }
+        return local;
+}
+
+int cidrips_local_add(cidrips_local_t *local, uint32_t addr, int cidr)
+{
+        addr_entry_t *e;
+        if (cidr < 0 || cidr > 32)
+        {
+                return 0;
+        }
+        if (local->buf.len == BUILDER_LOCAL_SIZE && !cidrips_local_flush(local))
+        {
+                return 0;
+        }
+        if (!set_reserve(&local->buf, local->buf.len + 1))
+        {
+                return 0;
+        }
+        e = &local->buf.items[local->buf.len++];
+        e->addr.addr = addr & (cidr ? ~0U << (32 - cidr) : 0);
+        e->addr.cidr = cidr;
+        e->addr.label = 0;
+        e->count = addr_v4_weight(cidr);
+        return 1;
+}
+
+int cidrips_local_flush(cidrips_local_t *local)
+{
+        addr_set_t *buf = &local->buf;
+        builder_segment_t *segment;
+        size_t i, j;
+        int shard;
+        buf->len = dedup_filter(&local->dedup, buf->items, buf->len, BUILDER_DEDUP_SLOTS);
+        if (!set_sort(buf))
+        {
+                // buffered subnets must not be dropped as repeats on retry
+                dedup_free(&local->dedup);
+                return 0;
+        }
+        for (i = 0; i < buf->len; i = j)
+        {
+                shard = builder_shard(&buf->items[i].addr);
+                for (j = i + 1; j < buf->len && builder_shard(&buf->items[j].addr) == shard; j++)
+                {
+                }
+                segment = malloc(sizeof(builder_segment_t));
+                if (!segment || !(segment->set.items = malloc((j - i) * sizeof(addr_entry_t))))
+                {
+                        free(segment);
+                        memmove(buf->items, buf->items + i, (buf->len - i) * sizeof(addr_entry_t));
+                        buf->len -= i;
+                        dedup_free(&local->dedup);
+                        return 0;
+                }
+                memcpy(segment->set.items, buf->items + i, (j - i) * sizeof(addr_entry_t));
+                segment->set.len = segment->set.cap = j - i;
+                builder_push(local->builder, shard, segment);
+        }
+        buf->len = 0;
+        return 1;
+}
+
+int cidrips_local_free(cidrips_local_t *local)
+{
+        int ok;
+        if (!local)
+        {
+                return 1;
+        }
+        ok = cidrips_local_flush(local);
+        set_free(&local->buf);
+        dedup_free(&local->dedup);
+        free(local);
+        return ok;
+}
+
+#define WATCH_TAIL 64
+#define WATCH_DEBOUNCE_MS 200
+
+// set by SIGINT or SIGTERM, watch_main() returns after current run
+static volatile sig_atomic_t watch_stopped;
+
+static void watch_signal(int sig)
+{
+        watch_stopped = sig;
+}
+
+/*
+ * Input file as it was parsed last time. Append is detected by the same
+ * file grown with the same bytes before old end.
+ */
+typedef struct
+{
+        int64_t ino, size, mtime;
+        int plain;
+        unsigned char tail[WATCH_TAIL];
+        size_t tail_len;
+} watch_state_t;
+
+static void watch_stat(const char *path, watch_state_t *ws)
+{
+        struct stat st;
+        unsigned char head[4];
+        size_t n;
+        FILE *f;
+        memset(ws, 0, sizeof(watch_state_t));
+        ws->size = -1;
+        if (stat(path, &st) != 0 || !(f = fopen(path, "rb")))
+        {
+                return;
+        }
+        ws->ino = (int64_t)st.st_ino;
+        ws->mtime = stat_mtime_ns(&st);
+        n = fread(head, 1, sizeof(head), f);
+        ws->plain = input_detect(head, n) == INPUT_PLAIN;
+        ws->tail_len = st.st_size < WATCH_TAIL ? (size_t)st.st_size : WATCH_TAIL;
+        if (fseek(f, (long)(st.st_size - ws->tail_len), SEEK_SET) == 0 &&
+            fread(ws->tail, 1, ws->tail_len, f) == ws->tail_len)
+        {
+                ws->size = (int64_t)st.st_size;
+        }
+        fclose(f);
+}
+
+static int watch_same_tail(const char *path, const watch_state_t *ws)
+{
+        unsigned char tail[WATCH_TAIL];
+        FILE *f = fopen(path, "rb");
+        int same;
+        if (!f)
+        {
+                return 0;
+        }
+        same = fseek(f, (long)(ws->size - ws->tail_len), SEEK_SET) == 0 &&
+               fread(tail, 1, ws->tail_len, f) == ws->tail_len && memcmp(tail, ws->tail, ws->tail_len) == 0;
+        fclose(f);
+        return same;
+}
+
+/*
+ * Compare inputs with their state at last parse. Returns 0 if nothing
+ * changed, 1 if files were only appended (append[i] is set), 2 if all
+ * inputs must be parsed again.
+ */
+static int watch_changes(args_t *args, const watch_state_t *old, watch_state_t *cur, int *append)
+{
+        int i, kind = 0;
+        for (i = 0; i < args->input_count; i++)
+        {
+                append[i] = 0;
+                watch_stat(args->input[i], &cur[i]);
+                if (old[i].size < 0 || cur[i].size < 0)
+                {
+                        kind = 2;
+                }
+                else if (cur[i].ino == old[i].ino && cur[i].size == old[i].size && cur[i].mtime == old[i].mtime)
+                {
+                        continue;
+                }
+                // old end must be end of line, else last line was read half-written
+                else if (old[i].plain && cur[i].ino == old[i].ino && cur[i].size > old[i].size &&
+                         old[i].tail_len > 0 && parse_is_separator(old[i].tail[old[i].tail_len - 1]) &&
+                         watch_same_tail(args->input[i], &old[i]))
+                {
+                        append[i] = 1;
+                        kind = kind > 1 ? kind : 1;
+                }
+                else
+                {
+                        kind = 2;
+                }
+        }
+        return kind;
+}
+
+static int watch_init(args_t *args)
+{
+#ifdef __linux__
+        char dir[256], *slash;
+        int fd = inotify_init1(IN_CLOEXEC), i;
+        if (fd < 0)
+        {
+                return -1;
+        }
+        // directory is watched, so file replaced by rename is seen too
+        for (i = 0; i < args->input_count; i++)
+        {
+                snprintf(dir, sizeof(dir), "%s", args->input[i]);
+                slash = strrchr(dir, '/');
+                if (!slash)
+                {
+                        strcpy(dir, ".");
+                }
+                else
+                {
+                        slash[slash == dir ? 1 : 0] = '\0';
+                }
+                if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE | IN_DELETE) < 0)
+                {
+                        close(fd);
+                        return -1;
+                }
+        }
+        return fd;
+#else
+        return -1;
+#endif
+}
+
+#ifdef __linux__
+static int watch_match(args_t *args, const char *name)
+{
+        const char *base;
+        int i;
+        for (i = 0; i < args->input_count; i++)
+        {
+                base = strrchr(args->input[i], '/');
+                if (strcmp(base ? base + 1 : args->input[i], name) == 0)
+                {
+                        return 1;
+                }
+        }
+        return 0;
+}
+#endif
+
+/*
+ * Block until inputs may have changed. inotify events are collected until
+ * inputs are quiet for WATCH_DEBOUNCE_MS, without inotify inputs are polled
+ * every second.
+ */
+static void watch_wait(int fd, args_t *args)
+{
+#ifdef __linux__
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        struct inotify_event *ev;
+        struct pollfd pfd = {fd, POLLIN, 0};
+        ssize_t n;
+        char *p;
+        int hit = 0, rc;
+        while (fd >= 0)
+        {
+                rc = poll(&pfd, 1, hit ? WATCH_DEBOUNCE_MS : -1);
+                if (rc == 0 || watch_stopped)
+                {
+                        return;
+                }
+                n = rc > 0 ? read(fd, buf, sizeof(buf)) : -1;
+                if (n <= 0)
+                {
+                        if (errno == EINTR)
+                        {
+                                continue;
+                        }
+                        break;
+                }
+                for (p = buf; p < buf + n; p += sizeof(struct inotify_event) + ev->len)
+                {
+                        ev = (struct inotify_event *)p;
+                        if (ev->len > 0 && watch_match(args, ev->name))
+                        {
+                                hit = 1;
+                        }
+                }
+        }
+#endif
+#ifdef _WIN32
+        Sleep(1000);
+#else
+        struct timespec ts = {1, 0};
+        nanosleep(&ts, (void *)0);
+#endif
+}
+
+/*
+ * Aggregate set and replace output files.
+ */
+static int watch_publish(args_t *args, const addr_set_t *set, labels_t *labels, struct compress_stats *stats)
+{
+        addr_list_t *head = (void *)0, *tail = (void *)0;
+        output_t out, report_file;
+        report_t report;
+        int count = -1, rc = 0;
+        if (args->report[0] && !report_open(&report, &report_file, args->report, labels))
+        {
+                fprintf(stderr, "Cannot open file: %s %s\n", args->report, strerror(errno));
+                return 0;
+        }
+        stats->report = args->report[0] ? &report : (void *)0;
+        if (set_to_list(set, &head, &tail))
+        {
+                count = aggregate(&head, &tail, args, stats, (void *)0);
+        }
+        if (stats->report)
+        {
+                rc = report_close(&report, &report_file, count < 0 ? ENOMEM : 0);
+                stats->report = (void *)0;
+        }
+        if (count < 0)
+        {
+                list_free(&head, &tail);
+                fprintf(stderr, "Cannot allocate memory.\n");
+                return 0;
+        }
+        if (rc)
+        {
+                list_free(&head, &tail);
+                fprintf(stderr, "I/O error: %s %s\n", args->report, strerror(rc));
+                return 0;
+        }
+        if (!args->no_stats)
+        {
+                print_stats(stdout, stats, count);
+                print_faults(stdout);
+                fflush(stdout);
+        }
+        if (args->label_output[0])
+        {
+                rc = write_labels((void *)0, args, labels, head);
+        }
+        else if (!output_open(&out, args->output, 0))
+        {
+                fprintf(stderr, "Cannot open file: %s %s\n", args->output, strerror(errno));
+                rc = -1;
+        }
+        else if (args->label_column)
+        {
+                rc = output_close(&out, write_labels(out.f, args, labels, head));
+        }
+        else
+        {
+                rc = output_close(&out, write_result(out.f, args, head, (void *)0, (void *)0));
+        }
+        if (rc > 0)
+        {
+                fprintf(stderr, "I/O error: %s\n", strerror(rc));
+        }
+        list_free(&head, &tail);
+        return rc == 0;
+}
+
+/*
+ * --watch: aggregate inputs, then wait for changes and aggregate again.
+ * Appended plain files are parsed from old end and merged into kept sorted
+ * set, other changes parse all inputs again. Parse and output errors keep
+ * previous output. Runs until SIGINT or SIGTERM and returns EXIT_SUCCESS if
+ * the last run replaced output, fails at once if the first run did not:
+ * there is no previous output to keep.
+ */
+static int watch_main(args_t *args, ingest_opts_t *opts, struct compress_stats *stats)
+{
+        watch_state_t old[ARGS_MAX_INPUTS], cur[ARGS_MAX_INPUTS];
+        addr_set_t set = {0}, tail = {0};
+        int append[ARGS_MAX_INPUTS];
+        int i, kind = 2, ok, fd = watch_init(args), first = 1;
+        char err[512];
+        for (i = 0; i < args->input_count; i++)
+        {
+                watch_stat(args->input[i], &cur[i]);
+        }
+        signal(SIGINT, watch_signal);
+        signal(SIGTERM, watch_signal);
+        while (1)
+        {
+                ok = 1;
+                if (kind == 2)
+                {
+                        set_free(&set);
+                        dedup_free(opts->dedup);
+                        opts->dedup->total = opts->dedup->duplicates = 0;
+                        if (opts->limit)
+                        {
+                                set_limit_init(opts->limit, args->max_memory, opts->limit->level);
+                        }
+                }
+                for (i = 0; i < args->input_count && ok; i++)
+                {
+                        if (kind == 2 || append[i])
+                        {
+                                opts->offset = kind == 2 ? 0 : (long)old[i].size;
+                                opts->length = cur[i].plain ? (long)(cur[i].size - opts->offset) : -1;
+                                ok = load_input(args->input[i], kind == 2 ? &set : &tail, opts, err, sizeof(err));
+                                if (ok && kind != 2 && !set_merge(&set, &tail))
+                                {
+                                        snprintf(err, sizeof(err), "Cannot allocate memory.");
+                                        ok = 0;
+                                }
+                                set_free(&tail);
+                        }
+                        old[i] = cur[i];
+                }
+                if (ok && opts->limit && set.len > opts->limit->max_len)
+                {
+                        set_shrink(&set, opts->limit);
+                }
+                if (ok && !watch_publish(args, &set, opts->labels, stats))
+                {
+                        fprintf(stderr, "--watch: output is not replaced.\n");
+                        ok = 0;
+                }
+                else if (!ok)
+                {
+                        // parse everything again on next change
+                        fprintf(stderr, "%s\n", err);
+                        for (i = 0; i < args->input_count; i++)
+                        {
+                                old[i].size = -1;
+                        }
+                }
+                if (first && !ok)
+                {
+                        break;
+                }
+                first = 0;
+                do
+                {
+                        watch_wait(fd, args);
+                        kind = watch_stopped ? 0 : watch_changes(args, old, cur, append);
+                } while (kind == 0 && !watch_stopped);
+                if (watch_stopped)
+                {
+                        break;
+                }
+        }
+        set_free(&set);
+        dedup_free(opts->dedup);
+#ifdef __linux__
+        if (fd >= 0)
+        {
+                close(fd);
+        }
+#endif
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#ifndef CIDRIPS_NO_MAIN
+int main(int argc, const char **argv)
+{
+        FILE *o;
+        int rc, i, count, level;
+        args_t args = {0};
+        args.postfix[0] = '\n';
+        args.postfix[1] = '\0';
+        args.chunk_size = 4096;
+        strcpy(args.set_name, "cidrips");
+        strcpy(args.table, "filter");
+        strcpy(args.route_args, "blackhole");
+        strcpy(args.announce_prefix, "+");
+        strcpy(args.withdraw_prefix, "-");
+        rc = cli_parse(argc, argv, &args);
+        if (!rc)
+        {
+                return EXIT_FAILURE;
+        }
+
+        if (args.help)
+        {
+                cli_help(stdout);
+                return EXIT_SUCCESS;
+        }
+
+        if (args.affinity[0] && !affinity_init(args.affinity))
+        {
+                return EXIT_FAILURE;
+        }
+
+        if (args.jobs[0])
+        {
+                return jobs_main(&args) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        if (args.input_count == 0 && !args.snapshot[0])
+        {
+                fprintf(stderr, "--input: required.\n");
+                return EXIT_FAILURE;
+        }
+
+        if (args.label_output[0] && !args.label_column)
+        {
+                fprintf(stderr, "--label-output: requires --label-column.\n");
+                return EXIT_FAILURE;
+        }
+
+        if (args.extract && args.label_column)
+        {
+                fprintf(stderr, "--extract: cannot be used with --label-column.\n");
+                return EXIT_FAILURE;
+        }
+
+        if (args.diff_against[0] && (args.label_column || args.watch || args.format != FORMAT_TEXT))
+        {
+                fprintf(stderr, "--diff-against: only text output, cannot be used with --label-column or --watch.\n");
+                return EXIT_FAILURE;
+        }
+
+        if (args.prefer_old && !args.diff_against[0])
+        {
+                fprintf(stderr, "--prefer-old: requires --diff-against.\n");
+                return EXIT_FAILURE;
+        }
+
+        if (args.variant_count && (args.output[0] || args.label_output[0] || args.watch || args.diff_against[0] ||
+                                   args.report[0] || args.estimate))
+        {
+                fprintf(stderr, "--variant: each variant has own out=, cannot be used with --output, "
+                                "--label-output, --watch, --diff-against, --report or --estimate.\n");
+                return EXIT_FAILURE;
+        }
+
+        if (args.estimate)
+        {
+                if (args.input_count == 0 || args.label_column || args.snapshot[0] || args.save_snapshot[0] ||
+                    args.watch || args.diff_against[0] || args.report[0])
+                {
+                        fprintf(stderr, "--estimate: requires --input, cannot be used with --label-column, "
+                                        "snapshots, --watch, --diff-against or --report.\n");
+                        return EXIT_FAILURE;
+                }
+                return estimate_main(&args) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        char err[512];
+        addr_list_t *head = (void *)0, *tail = (void *)0;
+        addr_set_t set = {0}, old = {0};
+        labels_t labels = {0};
+        snapshot_t snap = {0};
+        size_t announced, withdrawn;
+        snapshot_source_t sources[ARGS_MAX_INPUTS];
+        int source_count;
+        struct compress_stats stats = {0};
+        ingest_opts_t opts = {args.label_column ? &labels : (void *)0, args.extract, (void *)0, 0, -1, &stats.dedup,
+                              (void *)0};
+        labels.column = args.label_column;
+        if (args.max_memory)
+        {
+                // pre-aggregation must not merge more than the strictest variant
+                level = args.variant_count ? 32 : args.mode == MODE_COUNT ? 0 : args.level;
+                for (i = 0; i < args.variant_count; i++)
+                {
+                        count = args.variants[i].mode == MODE_COUNT ? 0 : args.variants[i].level;
+                        level = count < level ? count : level;
+                }
+                set_limit_init(&stats.limit, args.max_memory, level);
+                opts.limit = &stats.limit;
+        }
+        if (args.watch)
+        {
+                for (i = 0; i < args.input_count; i++)
+                {
+                        if (strcmp(args.input[i], "-") == 0)
+                        {
+                                break;
+                        }
+                }
+                if (args.input_count == 0 || i < args.input_count || args.snapshot[0] || args.save_snapshot[0] ||
+                    (!args.label_output[0] && (!args.output[0] || strcmp(args.output, "-") == 0)))
+                {
+                        fprintf(stderr, "--watch: requires --input files and --output file (or --label-output), "
+                                        "snapshots are not supported.\n");
+                        return EXIT_FAILURE;
+                }
+                // output is always replaced
+                args.append = 0;
+                rc = watch_main(&args, &opts, &stats);
+                labels_free(&labels);
+                return rc;
+        }
+        rc = SNAPSHOT_EIO;
+        if (args.snapshot[0])
+        {
+                rc = snapshot_open(&snap, args.snapshot, args.input, args.input_count, &labels, args.extract,
+                                   args.verify_snapshot, err, sizeof(err));
+                if (rc == SNAPSHOT_OK)
+                {
+                        args.label_column = labels.column;
+                }
+                else if (args.input_count == 0 || rc == SNAPSHOT_EMEM)
+                {
+                        labels_free(&labels);
+                        fprintf(stderr, "%s\n", err);
+                        return EXIT_FAILURE;
+                }
+                else if (rc == SNAPSHOT_EBAD)
+                {
+                        fprintf(stderr, "%s, parsing input.\n", err);
+                }
+        }
+        if (rc != SNAPSHOT_OK)
+        {
+                for (i = 0; i < args.input_count; i++)
+                {
+                        if (!load_input(args.input[i], &set, &opts, err, sizeof(err)))
+                        {
+                                set_free(&set);
+                                dedup_free(&stats.dedup);
+                                labels_free(&labels);
+                                fprintf(stderr, "%s\n", err);
+                                return EXIT_FAILURE;
+                        }
+                }
+                dedup_free(&stats.dedup);
+        }
+        if (args.save_snapshot[0])
+        {
+                for (i = 0; i < args.input_count; i++)
+                {
+                        snapshot_source(args.input[i], &sources[i]);
+                }
+                source_count = args.input_count;
+                // snapshot copied without inputs keeps its sources
+                if (rc == SNAPSHOT_OK && args.input_count == 0)
+                {
+                        memcpy(sources, snap.header.sources, sizeof(sources));
+                        source_count = snap.header.source_count;
+                        args.extract = snap.header.extract;
+                }
+                if (!snapshot_save(args.save_snapshot, rc == SNAPSHOT_OK ? &snap.set : &set, &labels, args.extract,
+                                   sources, source_count))
+                {
+                        fprintf(stderr, "Cannot write snapshot: %s %s\n", args.save_snapshot, strerror(errno));
+                        set_free(&set);
+                        snapshot_close(&snap);
+                        labels_free(&labels);
+                        return EXIT_FAILURE;
+                }
+                if (!args.output[0])
+                {
+                        set_free(&set);
+                        snapshot_close(&snap);
+                        labels_free(&labels);
+                        return EXIT_SUCCESS;
+                }
+        }
+        if (args.variant_count)
+        {
+                rc = variants_main(&args, rc == SNAPSHOT_OK ? &snap.set : &set, &labels, &stats);
+                set_free(&set);
+                snapshot_close(&snap);
+                labels_free(&labels);
+                return rc ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        rc = set_to_list(rc == SNAPSHOT_OK ? &snap.set : &set, &head, &tail);
+        set_free(&set);
+        snapshot_close(&snap);
+        if (!rc)
+        {
+                list_free(&head, &tail);
+                labels_free(&labels);
+                fprintf(stderr, "Cannot allocate memory.\n");
+                return EXIT_FAILURE;
+        }
+
+        // previous result is parsed as input, so any text list can be compared
+        if (args.diff_against[0])
+        {
+                ingest_opts_t old_opts = {(void *)0, 0, (void *)0, 0, -1, (void *)0, (void *)0};
+                if (!load_input(args.diff_against, &old, &old_opts, err, sizeof(err)))
+                {
+                        list_free(&head, &tail);
+                        set_free(&old);
+                        labels_free(&labels);
+                        fprintf(stderr, "--diff-against: %s\n", err);
+                        return EXIT_FAILURE;
+                }
+        }
+
+        report_t report;
+        output_t report_file;
+        if (args.report[0])
+        {
+                if (!report_open(&report, &report_file, args.report, &labels))
+                {
+                        list_free(&head, &tail);
+                        set_free(&old);
+                        labels_free(&labels);
+                        fprintf(stderr, "Cannot open file: %s %s\n", args.report, strerror(errno));
+                        return EXIT_FAILURE;
+                }
+                stats.report = &report;
+        }
+
+        count = aggregate(&head, &tail, &args, &stats, args.prefer_old ? &old : (void *)0);
+        rc = 0;
+        if (stats.report)
+        {
+                rc = report_close(&report, &report_file, count < 0 ? ENOMEM : 0);
+                stats.report = (void *)0;
+        }
+        if (count < 0)
+        {
+                list_free(&head, &tail);
+                set_free(&old);
+                labels_free(&labels);
+                fprintf(stderr, "Memory allocation error.\n");
+                return EXIT_FAILURE;
+        }
+        if (rc)
+        {
+                list_free(&head, &tail);
+                set_free(&old);
+                labels_free(&labels);
+                fprintf(stderr, "I/O error: %s %s\n", args.report, strerror(rc));
+                return EXIT_FAILURE;
+        }
+
+        if (!args.no_stats)
+        {
+                print_stats(stdout, &stats, count);
+                print_faults(stdout);
+        }
+
+        if (args.label_output[0])
+        {
+                rc = write_labels((void *)0, &args, &labels, head);
+                if (rc > 0)
+                {
+                        fprintf(stderr, "I/O error: %s\n", strerror(rc));
+                }
+                list_free(&head, &tail);
+                set_free(&old);
+                labels_free(&labels);
+                return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+
+        int output_file_reason;
+
+        if (strcmp(args.output, "-") == 0)
+        {
+                output_file_reason = REASON_STDOUT;
+        }
+        else
+        {
+                o = fopen(args.output, "r");
+                if (o)
+                {
+                        fseek(o, 0, SEEK_END);
+                        if (ftell(o) > 0)
+                        {
+                                if (strcmp(args.input[0], "-") == 0)
+                                {
+                                        if (args.overwrite)
+                                        {
+                                                output_file_reason = REASON_REWRITE;
+                                        }
+                                        else if (args.append)
+                                        {
+                                                output_file_reason = REASON_APPEND;
+                                        }
+                                        else
+                                        {
+                                                fprintf(stderr, "Output file is not "
+                                                                "empty. Cancelled.\n");
+                                                output_file_reason = REASON_CANCEL;
+                                        }
+                                }
+                                else
+                                {
+                                        if (args.overwrite)
+                                        {
+                                                output_file_reason = REASON_REWRITE;
+                                        }
+                                        else if (args.append)
+                                        {
+                                                output_file_reason = REASON_APPEND;
+                                        }
+                                        else if (args.cancel)
+                                        {
+                                                output_file_reason = REASON_CANCEL;
+                                        }
+                                        else
+                                        {
+                                                output_file_reason = ask_output_file_reason(args.output);
+                                        }
+                                }
+                        }
+                        else
+                        {
+                                output_file_reason = REASON_REWRITE;
+                        }
+                }
+                else
+                {
+                        output_file_reason = REASON_REWRITE;
+                }
+        }
+
+        output_t out;
+        if (output_file_reason == REASON_REWRITE || output_file_reason == REASON_APPEND)
+        {
+                o = output_open(&out, args.output, output_file_reason == REASON_APPEND) ? out.f : (void *)0;
+        }
+        else if (output_file_reason == REASON_STDOUT)
+        {
+                o = stdout;
+        }
+        else if (output_file_reason == REASON_CANCEL)
+        {
+                list_free(&head, &tail);
+                set_free(&old);
+                labels_free(&labels);
+                fprintf(stdout, "Cancelled by user.\n");
+                return EXIT_SUCCESS;
+        }
+
+        if (!o)
+        {
+                list_free(&head, &tail);
+                set_free(&old);
+                labels_free(&labels);
+                fprintf(stderr, "Cannot open file: %s %s\n", args.output, strerror(errno));
+                return EXIT_FAILURE;
+        }
+
+        if (args.diff_against[0])
+        {
+                rc = write_diff(o, &args, head, &old, &announced, &withdrawn);
+                if (!rc && !args.no_stats)
+                {
+                        fprintf(stdout, "diff: announce=%zu, withdraw=%zu, kept=%zu\n", announced, withdrawn,
+                                (size_t)count - announced);
+                }
+        }
+        else if (args.label_column)
+        {
+                rc = write_labels(o, &args, &labels, head);
+        }
+        else
+        {
+                rc = write_result(o, &args, head, (void *)0, (void *)0);
+        }
+        if (o != stdout)
+        {
+                rc = output_close(&out, rc);
+        }
+        if (rc)
+        {
+                if (rc > 0)
+                {
+                        fprintf(stderr, "I/O error: %s\n", strerror(rc));
+                }
+                list_free(&head, &tail);
+                set_free(&old);
+                labels_free(&labels);
+                return EXIT_FAILURE;
+        }
+
+        list_free(&head, &tail);
+        set_free(&old);
+        labels_free(&labels);
+        return EXIT_SUCCESS;
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,74 @@
+#ifndef CIDRIPS_H
+#define CIDRIPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Builder API: addresses are added concurrently from many threads and
+ * aggregated once at the end, same as cidrips --mode=level/count does with
+ * file input. Library is cidrips.c built with CIDRIPS_NO_MAIN (CMake target
+ * libcidrips).
+ *
+ *      cidrips_builder_t *b = cidrips_builder_new();
+ *      // in every thread
+ *      cidrips_local_t *l = cidrips_local_new(b);
+ *      cidrips_local_add(l, 0x0a000001, 32);
+ *      cidrips_local_free(l);
+ *      // after all threads are done
+ *      cidrips_builder_finalize(b, 2, 0, &subnets, &count);
+ *
+ * Every thread owns its cidrips_local_t buffer, full buffer is sorted and
+ * passed to builder without global lock. Functions returning int return 1
+ * on success and 0 if out of memory.
+ */
+typedef struct cidrips_builder cidrips_builder_t;
+typedef struct cidrips_local cidrips_local_t;
+
+typedef struct
+{
+        uint32_t addr; // host byte order
+        int cidr;
+        size_t count; // count of source addresses covered
+} cidrips_subnet_t;
+
+cidrips_builder_t *cidrips_builder_new(void);
+
+/*
+ * Merge added subnets and aggregate them: with max_count = 0 by level
+ * (--mode=level), else with lowest level giving not more than max_count
+ * subnets (--mode=count). Result is sorted array, free() it. All local
+ * buffers must be freed or flushed before, builder is empty after.
+ */
+int cidrips_builder_finalize(cidrips_builder_t *builder, int level, size_t max_count, cidrips_subnet_t **subnets,
+                             size_t *count);
+
+void cidrips_builder_free(cidrips_builder_t *builder);
+
+/*
+ * Buffer of one thread. Must not be shared between threads.
+ */
+cidrips_local_t *cidrips_local_new(cidrips_builder_t *builder);
+
+int cidrips_local_add(cidrips_local_t *local, uint32_t addr, int cidr);
+
+/*
+ * Pass buffered subnets to builder.
+ */
+int cidrips_local_flush(cidrips_local_t *local);
+
+/*
+ * Flush and free buffer. Returns result of flush.
+ */
+int cidrips_local_free(cidrips_local_t *local);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
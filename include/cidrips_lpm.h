@@ -0,0 +1,171 @@
+#ifndef CIDRIPS_LPM_H
+#define CIDRIPS_LPM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Reader of cidrips --output-format=lpm-table files. Header only, file is
+ * used as is from memory (mmap or read into buffer, 8 bytes aligned):
+ *
+ *      cidrips_lpm_t lpm;
+ *      uint32_t value;
+ *      if (cidrips_lpm_open(&lpm, data, size) && cidrips_lpm_lookup(&lpm, 0x0a000001, &value))
+ *              printf("%s\n", cidrips_lpm_label(&lpm, value));
+ *
+ * Table is sorted array of disjoint address ranges [first, last] with value
+ * of longest matching prefix (label id with --label-column, else 0) and
+ * index of first range for every /16. Lookup is binary search inside /16.
+ * Numbers are in byte order of writer, open() rejects other byte order.
+ */
+#define CIDRIPS_LPM_MAGIC "CIDRLPM"
+#define CIDRIPS_LPM_VERSION 1
+#define CIDRIPS_LPM_INDEX_SIZE 65537
+
+typedef struct
+{
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;    // 0x01020304
+        uint32_t range_count;
+        uint32_t label_count;   // 0 without labels
+        uint64_t index_offset;  // uint32_t[CIDRIPS_LPM_INDEX_SIZE], first range with last >= (i << 16)
+        uint64_t first_offset;  // uint32_t[range_count], ascending
+        uint64_t last_offset;   // uint32_t[range_count]
+        uint64_t value_offset;  // uint32_t[range_count]
+        uint64_t label_offset;  // uint32_t[label_count], offset of name from names_offset
+        uint64_t names_offset;  // label names terminated by '\0'
+        uint64_t file_size;
+        uint64_t checksum;      // cidrips_lpm_checksum() of bytes after header
+} cidrips_lpm_header_t;
+
+typedef struct
+{
+        const cidrips_lpm_header_t *header;
+        const uint32_t *index, *first, *last, *value, *label;
+        const char *names;
+        size_t names_size;
+} cidrips_lpm_t;
+
+static inline uint64_t cidrips_lpm_checksum(uint64_t h, const void *data, size_t size)
+{
+        const unsigned char *p = (const unsigned char *)data;
+        uint64_t w;
+        size_t i;
+        for (i = 0; i + 8 <= size; i += 8)
+        {
+                memcpy(&w, p + i, 8);
+                h = (h ^ w) * 0x100000001b3ULL;
+                h ^= h >> 29;
+        }
+        for (; i < size; i++)
+        {
+                h = (h ^ p[i]) * 0x100000001b3ULL;
+        }
+        return h;
+}
+
+static inline int cidrips_lpm_section(uint64_t offset, uint64_t count, uint64_t size)
+{
+        return offset % 4 == 0 && offset >= sizeof(cidrips_lpm_header_t) && offset <= size &&
+               count <= (size - offset) / 4;
+}
+
+/*
+ * Check header, sections and checksum of file of size bytes. Returns 1 if
+ * table can be used.
+ */
+static inline int cidrips_lpm_open(cidrips_lpm_t *lpm, const void *data, size_t size)
+{
+        const cidrips_lpm_header_t *h = (const cidrips_lpm_header_t *)data;
+        const char *base = (const char *)data;
+        uint32_t i;
+        if (size < sizeof(cidrips_lpm_header_t) || memcmp(h->magic, CIDRIPS_LPM_MAGIC, 8) != 0 ||
+            h->version != CIDRIPS_LPM_VERSION || h->byte_order != 0x01020304 || h->file_size != size ||
+            !cidrips_lpm_section(h->index_offset, CIDRIPS_LPM_INDEX_SIZE, size) ||
+            !cidrips_lpm_section(h->first_offset, h->range_count, size) ||
+            !cidrips_lpm_section(h->last_offset, h->range_count, size) ||
+            !cidrips_lpm_section(h->value_offset, h->range_count, size) ||
+            !cidrips_lpm_section(h->label_offset, h->label_count, size) || h->names_offset > size)
+        {
+                return 0;
+        }
+        if (cidrips_lpm_checksum(0xcbf29ce484222325ULL, base + sizeof(cidrips_lpm_header_t),
+                                 size - sizeof(cidrips_lpm_header_t)) != h->checksum)
+        {
+                return 0;
+        }
+        lpm->header = h;
+        lpm->index = (const uint32_t *)(base + h->index_offset);
+        lpm->first = (const uint32_t *)(base + h->first_offset);
+        lpm->last = (const uint32_t *)(base + h->last_offset);
+        lpm->value = (const uint32_t *)(base + h->value_offset);
+        lpm->label = (const uint32_t *)(base + h->label_offset);
+        lpm->names = base + h->names_offset;
+        lpm->names_size = (size_t)(size - h->names_offset);
+        for (i = 0; i < CIDRIPS_LPM_INDEX_SIZE; i++)
+        {
+                if (lpm->index[i] > h->range_count || (i > 0 && lpm->index[i] < lpm->index[i - 1]))
+                {
+                        return 0;
+                }
+        }
+        for (i = 0; i < h->label_count; i++)
+        {
+                if (lpm->label[i] >= lpm->names_size || !memchr(lpm->names + lpm->label[i], '\0',
+                                                                lpm->names_size - lpm->label[i]))
+                {
+                        return 0;
+                }
+        }
+        return 1;
+}
+
+/*
+ * Value of longest prefix containing addr (host byte order). Returns 0 if
+ * addr is not covered.
+ */
+static inline int cidrips_lpm_lookup(const cidrips_lpm_t *lpm, uint32_t addr, uint32_t *value)
+{
+        uint32_t lo = lpm->index[addr >> 16], hi = lpm->index[(addr >> 16) + 1], mid;
+        // range starting in previous /16 is found by index, ranges of this /16 follow it
+        hi = hi < lpm->header->range_count ? hi + 1 : hi;
+        while (lo < hi)
+        {
+                mid = lo + (hi - lo) / 2;
+                if (lpm->first[mid] <= addr)
+                {
+                        lo = mid + 1;
+                }
+                else
+                {
+                        hi = mid;
+                }
+        }
+        if (lo == 0 || lpm->last[lo - 1] < addr)
+        {
+                return 0;
+        }
+        *value = lpm->value[lo - 1];
+        return 1;
+}
+
+/*
+ * Label name of value, NULL without labels.
+ */
+static inline const char *cidrips_lpm_label(const cidrips_lpm_t *lpm, uint32_t value)
+{
+        return value < lpm->header->label_count ? lpm->names + lpm->label[value] : (const char *)0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * Stress test of builder API: THREADS threads add COUNT addresses in total
+ * (overlapping ranges, repeats, some /24) through own cidrips_local_t and
+ * flush at random moments. Every added address is written into INPUT, the
+ * finalized result into OUTPUT in cidrips text format, so the result can be
+ * compared with cidrips -i INPUT (tests/builder_test.cmake).
+ *
+ *      test_builder_stress INPUT OUTPUT THREADS COUNT LEVEL [MAX_COUNT]
+ */
+#include "cidrips.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct
+{
+        cidrips_builder_t *builder;
+        uint64_t seed;
+        size_t count;
+        uint32_t *addr;
+        int *cidr;
+        int ok;
+} stress_worker_t;
+
+static uint64_t stress_rand(uint64_t *x)
+{
+        *x ^= *x << 13;
+        *x ^= *x >> 7;
+        *x ^= *x << 17;
+        return *x;
+}
+
+static void *stress_worker(void *arg)
+{
+        stress_worker_t *w = arg;
+        cidrips_local_t *local = cidrips_local_new(w->builder);
+        uint64_t r;
+        size_t i;
+        w->ok = local != (void *)0;
+        for (i = 0; w->ok && i < w->count; i++)
+        {
+                r = stress_rand(&w->seed);
+                // all threads share 10.0.0.0/12, so shards and repeats are hit from every thread
+                w->addr[i] = 0x0a000000 | (uint32_t)(r & 0xfffff);
+                w->cidr[i] = (r >> 32) % 64 == 0 ? 24 : 32;
+                w->addr[i] &= w->cidr[i] == 24 ? 0xffffff00 : 0xffffffff;
+                w->ok = cidrips_local_add(local, w->addr[i], w->cidr[i]);
+                if (w->ok && (r >> 40) % 50000 == 0)
+                {
+                        w->ok = cidrips_local_flush(local);
+                }
+        }
+        if (local && !cidrips_local_free(local))
+        {
+                w->ok = 0;
+        }
+        return (void *)0;
+}
+
+static void stress_print(FILE *f, uint32_t a, int cidr)
+{
+        fprintf(f, "%u.%u.%u.%u", a >> 24, (a >> 16) & 255, (a >> 8) & 255, a & 255);
+        if (cidr != 32)
+        {
+                fprintf(f, "/%d", cidr);
+        }
+        fprintf(f, "\n");
+}
+
+int main(int argc, char **argv)
+{
+        cidrips_builder_t *builder;
+        cidrips_subnet_t *subnets;
+        stress_worker_t *workers;
+        pthread_t *threads;
+        FILE *input, *output;
+        size_t count, subnet_count, i, j;
+        int thread_count, level, ok = 1;
+        if (argc < 6)
+        {
+                fprintf(stderr, "usage: test_builder_stress INPUT OUTPUT THREADS COUNT LEVEL [MAX_COUNT]\n");
+                return EXIT_FAILURE;
+        }
+        thread_count = atoi(argv[3]);
+        count = strtoull(argv[4], (void *)0, 10);
+        level = atoi(argv[5]);
+        builder = cidrips_builder_new();
+        workers = calloc(thread_count, sizeof(stress_worker_t));
+        threads = calloc(thread_count, sizeof(pthread_t));
+        if (thread_count < 1 || !builder || !workers || !threads)
+        {
+                fprintf(stderr, "cannot start test\n");
+                return EXIT_FAILURE;
+        }
+        for (i = 0; i < (size_t)thread_count; i++)
+        {
+                workers[i].builder = builder;
+                workers[i].seed = 88172645463325252ULL + i * 7919;
+                workers[i].count = count / thread_count;
+                workers[i].addr = malloc(workers[i].count * sizeof(uint32_t) + 1);
+                workers[i].cidr = malloc(workers[i].count * sizeof(int) + 1);
+                if (!workers[i].addr || !workers[i].cidr ||
+                    pthread_create(&threads[i], (void *)0, stress_worker, &workers[i]) != 0)
+                {
+                        fprintf(stderr, "cannot start thread\n");
+                        return EXIT_FAILURE;
+                }
+        }
+        for (i = 0; i < (size_t)thread_count; i++)
+        {
+                pthread_join(threads[i], (void *)0);
+                ok = ok && workers[i].ok;
+        }
+        if (!ok || !cidrips_builder_finalize(builder, level, argc > 6 ? strtoull(argv[6], (void *)0, 10) : 0, &subnets,
+                                             &subnet_count))
+        {
+                fprintf(stderr, "builder failed\n");
+                return EXIT_FAILURE;
+        }
+        input = fopen(argv[1], "w");
+        output = fopen(argv[2], "w");
+        if (!input || !output)
+        {
+                fprintf(stderr, "cannot open output files\n");
+                return EXIT_FAILURE;
+        }
+        for (i = 0; i < (size_t)thread_count; i++)
+        {
+                for (j = 0; j < workers[i].count; j++)
+                {
+                        stress_print(input, workers[i].addr[j], workers[i].cidr[j]);
+                }
+                free(workers[i].addr);
+                free(workers[i].cidr);
+        }
+        for (i = 0; i < subnet_count; i++)
+        {
+                stress_print(output, subnets[i].addr, subnets[i].cidr);
+        }
+        fclose(input);
+        fclose(output);
+        free(subnets);
+        free(workers);
+        free(threads);
+        cidrips_builder_free(builder);
+        return EXIT_SUCCESS;
+}
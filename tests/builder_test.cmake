@@ -0,0 +1,24 @@
+# Run builder stress test (STRESS) and compare its result with cidrips
+# (CIDRIPS) run on the addresses the test has added.
+set(input ${WORK_DIR}/${NAME}.txt)
+set(result ${WORK_DIR}/${NAME}.result)
+if (MAX_COUNT)
+  set(mode -mcount -c${MAX_COUNT})
+else()
+  set(mode -mlevel -l${LEVEL})
+endif()
+execute_process(COMMAND ${STRESS} ${input} ${result} ${THREADS} ${COUNT} ${LEVEL} ${MAX_COUNT}
+                RESULT_VARIABLE rc)
+if (NOT rc EQUAL 0)
+  message(FATAL_ERROR "stress test failed: ${rc}")
+endif()
+execute_process(COMMAND ${CIDRIPS} -i ${input} -o - -s ${mode}
+                OUTPUT_VARIABLE output
+                RESULT_VARIABLE rc)
+if (NOT rc EQUAL 0)
+  message(FATAL_ERROR "cidrips failed: ${rc}")
+endif()
+file(READ ${result} expected)
+if (NOT output STREQUAL expected)
+  message(FATAL_ERROR "builder result ${result} differs from cidrips -i ${input} ${mode}")
+endif()
@@ -0,0 +1,92 @@
+# Run cidrips (CIDRIPS) with ARGS (separated by |) and check the run:
+#   STDIN     file passed to standard input
+#   TEXT      text passed to standard input (instead of STDIN)
+#   PIPE      file passed to standard input through pipe (instead of STDIN)
+#   EXPECTED  file equal to standard output
+#   MATCH     regular expression which must be found in standard output
+#   ERROR     cidrips must fail with regular expression in standard error
+#   COMPARE   pairs of files written|expected which must be equal
+#   COPY      pairs of files source|destination copied before run
+# cidrips runs in WORK, so relative paths of job manifests are there. Files
+# of COMPARE are removed before run. Line endings are not compared.
+string(REPLACE "|" ";" args "${ARGS}")
+string(REPLACE "|" ";" compare "${COMPARE}")
+string(REPLACE "|" ";" copy "${COPY}")
+set(stdin)
+set(pipe)
+if (TEXT)
+  set(STDIN ${WORK}/${NAME}.stdin)
+  string(REPLACE "|" "\n" text "${TEXT}")
+  file(WRITE ${STDIN} "${text}\n")
+endif()
+if (STDIN)
+  set(stdin INPUT_FILE ${STDIN})
+endif()
+if (PIPE)
+  # regular file on standard input is read inline, pipe goes to reader thread
+  set(pipe COMMAND ${CMAKE_COMMAND} -E cat ${PIPE})
+endif()
+foreach(i RANGE 0 99 2)
+  list(LENGTH copy n)
+  if (NOT i LESS n)
+    break()
+  endif()
+  math(EXPR j "${i} + 1")
+  list(GET copy ${i} from)
+  list(GET copy ${j} to)
+  file(COPY_FILE ${from} ${to})
+endforeach()
+foreach(i RANGE 0 99 2)
+  list(LENGTH compare n)
+  if (NOT i LESS n)
+    break()
+  endif()
+  list(GET compare ${i} written)
+  file(REMOVE ${written})
+endforeach()
+execute_process(${pipe}
+                COMMAND ${CIDRIPS} ${args}
+                ${stdin}
+                WORKING_DIRECTORY ${WORK}
+                OUTPUT_VARIABLE output
+                ERROR_VARIABLE error
+                RESULT_VARIABLE rc)
+if (ERROR)
+  if (rc EQUAL 0)
+    message(FATAL_ERROR "cidrips did not fail, output:\n${output}")
+  endif()
+  if (NOT error MATCHES "${ERROR}")
+    message(FATAL_ERROR "error does not match ${ERROR}:\n${error}")
+  endif()
+  return()
+endif()
+if (NOT rc EQUAL 0)
+  message(FATAL_ERROR "cidrips failed: ${rc}\n${error}")
+endif()
+string(REPLACE "\r\n" "\n" output "${output}")
+if (EXPECTED)
+  file(READ ${EXPECTED} expected)
+  string(REPLACE "\r\n" "\n" expected "${expected}")
+  if (NOT output STREQUAL expected)
+    message(FATAL_ERROR "output differs from ${EXPECTED}:\n${output}")
+  endif()
+endif()
+if (MATCH AND NOT output MATCHES "${MATCH}")
+  message(FATAL_ERROR "output does not match ${MATCH}:\n${output}")
+endif()
+foreach(i RANGE 0 99 2)
+  list(LENGTH compare n)
+  if (NOT i LESS n)
+    break()
+  endif()
+  math(EXPR j "${i} + 1")
+  list(GET compare ${i} written)
+  list(GET compare ${j} expected)
+  file(READ ${written} a)
+  file(READ ${expected} b)
+  string(REPLACE "\r\n" "\n" a "${a}")
+  string(REPLACE "\r\n" "\n" b "${b}")
+  if (NOT a STREQUAL b)
+    message(FATAL_ERROR "${written} differs from ${expected}:\n${a}")
+  endif()
+endforeach()
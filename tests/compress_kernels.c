@@ -0,0 +1,142 @@
+/*
+ * Boundary kernel chosen by compress_bounds_kernel() (and every other kernel
+ * built for this CPU) must give the same boundaries and the same merge
+ * result as the scalar one at every prefix of every aggregation level.
+ * Internal functions are reached by including cidrips.c built without
+ * main().
+ *
+ *      test_compress_kernels FILE
+ *
+ * FILE holds subnets, one per line, e.g. tests/data/level0_run.txt.
+ */
+#include "../cidrips.c"
+
+typedef struct
+{
+        const char *name;
+        compress_bounds_cb *kernel;
+} test_kernel_t;
+
+static void test_bounds_scalar(const uint32_t *addr, size_t n, uint32_t mask, uint64_t *bounds)
+{
+        compress_bounds_range(addr, 1, n, mask, bounds);
+}
+
+static void test_buf_free(compress_buf_t *b)
+{
+        free(b->addr);
+        free(b->cidr);
+        free(b->count);
+        free(b->bounds);
+}
+
+/*
+ * Arrays of compress() for up to n subnets. Returns 0 if out of memory.
+ */
+static int test_buf_alloc(compress_buf_t *b, size_t n)
+{
+        b->addr = malloc(n * sizeof(uint32_t));
+        b->cidr = malloc(n * sizeof(uint8_t));
+        b->count = malloc(n * sizeof(uint64_t));
+        b->bounds = malloc(((n + 63) / 64) * sizeof(uint64_t));
+        b->label = 0;
+        if (!b->addr || !b->cidr || !b->count || !b->bounds)
+        {
+                test_buf_free(b);
+                return 0;
+        }
+        return 1;
+}
+
+static int test_addr_cmp(const void *a, const void *b)
+{
+        uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+        return x < y ? -1 : x > y;
+}
+
+/*
+ * Run all levels of compress() with kernel k and scalar kernel side by
+ * side on copies of src. Returns 0 on first difference.
+ */
+static int test_kernel(const test_kernel_t *k, const compress_buf_t *src, size_t n, int level)
+{
+        compress_buf_t a, b;
+        size_t na = n, nb = n;
+        int i, ok = test_buf_alloc(&a, n) && test_buf_alloc(&b, n);
+        if (!ok)
+        {
+                fprintf(stderr, "out of memory\n");
+                return 0;
+        }
+        memcpy(a.addr, src->addr, n * sizeof(uint32_t));
+        memcpy(a.cidr, src->cidr, n * sizeof(uint8_t));
+        memcpy(a.count, src->count, n * sizeof(uint64_t));
+        memcpy(b.addr, src->addr, n * sizeof(uint32_t));
+        memcpy(b.cidr, src->cidr, n * sizeof(uint8_t));
+        memcpy(b.count, src->count, n * sizeof(uint64_t));
+        for (i = 31; ok && i >= 0; i--)
+        {
+                na = compress_level(&a, na, i, level, (void *)0, k->kernel);
+                nb = compress_level(&b, nb, i, level, (void *)0, test_bounds_scalar);
+                // bounds are left from the last kernel run of the level
+                ok = na == nb && memcmp(a.bounds, b.bounds, ((n + 63) / 64) * sizeof(uint64_t)) == 0 &&
+                     memcmp(a.addr, b.addr, na * sizeof(uint32_t)) == 0 &&
+                     memcmp(a.cidr, b.cidr, na * sizeof(uint8_t)) == 0 &&
+                     memcmp(a.count, b.count, na * sizeof(uint64_t)) == 0;
+                if (!ok)
+                {
+                        fprintf(stderr, "%s: differs from scalar at /%d of level %d\n", k->name, i, level);
+                }
+        }
+        test_buf_free(&a);
+        test_buf_free(&b);
+        return ok;
+}
+
+int main(int argc, char **argv)
+{
+        const test_kernel_t kernels[] = {
+            {"dispatched", compress_bounds_kernel()},
+#if defined(__SSE2__) || defined(_M_X64)
+            {"sse2", compress_bounds_sse2},
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+            {"neon", compress_bounds_neon},
+#endif
+        };
+        compress_buf_t src;
+        FILE *f;
+        char line[256];
+        unsigned int a, b, c, d, cidr;
+        size_t n = 0, cap = 1024, k;
+        int level, ok = 1;
+        if (argc < 2 || !(f = fopen(argv[1], "r")) || !test_buf_alloc(&src, cap))
+        {
+                fprintf(stderr, "usage: test_compress_kernels FILE\n");
+                return EXIT_FAILURE;
+        }
+        while (fgets(line, sizeof(line), f) && n < cap)
+        {
+                cidr = 32;
+                if (sscanf(line, "%u.%u.%u.%u/%u", &a, &b, &c, &d, &cidr) >= 4 && cidr == 32)
+                {
+                        src.addr[n++] = a << 24 | b << 16 | c << 8 | d;
+                }
+        }
+        fclose(f);
+        qsort(src.addr, n, sizeof(uint32_t), test_addr_cmp);
+        for (k = 0; k < n; k++)
+        {
+                src.cidr[k] = 32;
+                src.count[k] = 1;
+        }
+        for (level = 0; level <= 32; level++)
+        {
+                for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+                {
+                        ok = test_kernel(&kernels[k], &src, n, level) && ok;
+                }
+        }
+        printf("%zu subnets, levels 0-32: %s\n", n, ok ? "ok" : "failed");
+        test_buf_free(&src);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
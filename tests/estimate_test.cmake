@@ -0,0 +1,46 @@
+# Run cidrips (CIDRIPS) --estimate on INPUT and check that subnets and
+# coverage of every level are within estimated bounds of the exact run, and
+# that level found for COUNT by --mode=count is within estimated levels.
+execute_process(COMMAND ${CIDRIPS} -i ${INPUT} --estimate -mcount -c${COUNT}
+                OUTPUT_VARIABLE estimate
+                RESULT_VARIABLE rc)
+if (NOT rc EQUAL 0)
+  message(FATAL_ERROR "cidrips --estimate failed: ${rc}")
+endif()
+set(range "[0-9]+ \\(([0-9]+)\\.\\.([0-9]+)\\)")
+foreach(level RANGE 0 32)
+  if (NOT estimate MATCHES "\nlevel=${level}, subnets=${range}, coverage=${range}")
+    message(FATAL_ERROR "no estimate of level ${level}:\n${estimate}")
+  endif()
+  set(min ${CMAKE_MATCH_1})
+  set(max ${CMAKE_MATCH_2})
+  set(coverage_min ${CMAKE_MATCH_3})
+  set(coverage_max ${CMAKE_MATCH_4})
+  execute_process(COMMAND ${CIDRIPS} -i ${INPUT} -o - -mlevel -l${level}
+                  OUTPUT_VARIABLE output
+                  RESULT_VARIABLE rc)
+  if (NOT rc EQUAL 0 OR NOT output MATCHES "coverage=([0-9]+), [^\n]*; result=([0-9]+)")
+    message(FATAL_ERROR "cidrips failed at level ${level}: ${rc}")
+  endif()
+  if (CMAKE_MATCH_2 LESS min OR CMAKE_MATCH_2 GREATER max OR
+      CMAKE_MATCH_1 LESS coverage_min OR CMAKE_MATCH_1 GREATER coverage_max)
+    message(FATAL_ERROR "level ${level}: subnets=${CMAKE_MATCH_2} coverage=${CMAKE_MATCH_1} out of estimated "
+                        "${min}..${max} and ${coverage_min}..${coverage_max}")
+  endif()
+endforeach()
+if (NOT estimate MATCHES "count=${COUNT}: level=${range}")
+  message(FATAL_ERROR "no estimate of count ${COUNT}:\n${estimate}")
+endif()
+set(min ${CMAKE_MATCH_1})
+set(max ${CMAKE_MATCH_2})
+file(REMOVE ${WORK_DIR}/${NAME}.csv)
+execute_process(COMMAND ${CIDRIPS} -i ${INPUT} -o - -s -mcount -c${COUNT} --report=${WORK_DIR}/${NAME}.csv
+                RESULT_VARIABLE rc)
+file(STRINGS ${WORK_DIR}/${NAME}.csv rows)
+list(GET rows 1 row)
+if (NOT rc EQUAL 0 OR NOT row MATCHES ",([0-9]+)$")
+  message(FATAL_ERROR "cidrips failed for count ${COUNT}: ${rc}")
+endif()
+if (CMAKE_MATCH_1 LESS min OR CMAKE_MATCH_1 GREATER max)
+  message(FATAL_ERROR "count ${COUNT}: level ${CMAKE_MATCH_1} out of estimated ${min}..${max}")
+endif()
@@ -0,0 +1,187 @@
+/*
+ * Cross-check of lpm-table reader with brute force longest prefix match:
+ * every lookup of TABLE (cidrips --output-format=lpm-table) must give the
+ * value of the longest subnet of PREFIXES (cidrips text output of the same
+ * input, "label subnet" lines with labels) containing the address.
+ *
+ *      test_lpm_check TABLE PREFIXES [LOOKUPS]
+ *
+ * Checked are bounds of every subnet and its neighbours, and LOOKUPS
+ * (default 100000) random addresses.
+ */
+#include "cidrips_lpm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct
+{
+        uint32_t first, last, cidr, value;
+} check_prefix_t;
+
+static uint64_t check_rand(uint64_t *x)
+{
+        *x ^= *x << 13;
+        *x ^= *x >> 7;
+        *x ^= *x << 17;
+        return *x;
+}
+
+/*
+ * Read whole file into buffer aligned for the table.
+ */
+static void *check_load(const char *name, size_t *size)
+{
+        FILE *f = fopen(name, "rb");
+        uint64_t *data;
+        long n;
+        if (!f)
+        {
+                return (void *)0;
+        }
+        if (fseek(f, 0, SEEK_END) != 0 || (n = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0)
+        {
+                fclose(f);
+                return (void *)0;
+        }
+        data = malloc((size_t)n + 8);
+        if (data && fread(data, 1, (size_t)n, f) != (size_t)n)
+        {
+                free(data);
+                data = (void *)0;
+        }
+        fclose(f);
+        *size = (size_t)n;
+        return data;
+}
+
+/*
+ * Value of longest prefix containing addr, equal prefixes of several labels
+ * give the bigger label id like the writer does.
+ */
+static int check_brute(const check_prefix_t *p, size_t n, uint32_t addr, uint32_t *value)
+{
+        size_t i, best = n;
+        for (i = 0; i < n; i++)
+        {
+                if (p[i].first <= addr && addr <= p[i].last &&
+                    (best == n || p[i].cidr > p[best].cidr ||
+                     (p[i].cidr == p[best].cidr && p[i].value > p[best].value)))
+                {
+                        best = i;
+                }
+        }
+        if (best == n)
+        {
+                return 0;
+        }
+        *value = p[best].value;
+        return 1;
+}
+
+static int check_addr(const cidrips_lpm_t *lpm, const check_prefix_t *p, size_t n, uint32_t addr)
+{
+        uint32_t expected = 0, value = 0;
+        int found = check_brute(p, n, addr, &expected);
+        if (cidrips_lpm_lookup(lpm, addr, &value) != found || (found && value != expected))
+        {
+                fprintf(stderr, "%u.%u.%u.%u: lookup %s %u, expected %s %u\n", addr >> 24, (addr >> 16) & 255,
+                        (addr >> 8) & 255, addr & 255, found ? "found" : "not found", value,
+                        found ? "found" : "not found", expected);
+                return 0;
+        }
+        return 1;
+}
+
+int main(int argc, char **argv)
+{
+        cidrips_lpm_t lpm;
+        check_prefix_t *prefixes;
+        FILE *f;
+        char line[512], label[256], *s;
+        unsigned int a, b, c, d, cidr;
+        uint64_t x = 88172645463325252ULL;
+        uint32_t mask;
+        size_t size, n = 0, cap = 1024, lookups, i;
+        void *data;
+        int ok = 1;
+        if (argc < 3)
+        {
+                fprintf(stderr, "usage: test_lpm_check TABLE PREFIXES [LOOKUPS]\n");
+                return EXIT_FAILURE;
+        }
+        lookups = argc > 3 ? strtoull(argv[3], (void *)0, 10) : 100000;
+        data = check_load(argv[1], &size);
+        if (!data || !cidrips_lpm_open(&lpm, data, size))
+        {
+                fprintf(stderr, "%s: cannot open table\n", argv[1]);
+                return EXIT_FAILURE;
+        }
+        f = fopen(argv[2], "r");
+        prefixes = malloc(cap * sizeof(check_prefix_t));
+        if (!f || !prefixes)
+        {
+                fprintf(stderr, "%s: cannot read prefixes\n", argv[2]);
+                return EXIT_FAILURE;
+        }
+        while (fgets(line, sizeof(line), f))
+        {
+                s = line;
+                if (n == cap)
+                {
+                        cap *= 2;
+                        prefixes = realloc(prefixes, cap * sizeof(check_prefix_t));
+                        if (!prefixes)
+                        {
+                                return EXIT_FAILURE;
+                        }
+                }
+                prefixes[n].value = 0;
+                if (lpm.header->label_count > 0)
+                {
+                        if (sscanf(line, "%255s", label) != 1 || !(s = strchr(line, ' ')))
+                        {
+                                continue;
+                        }
+                        while (prefixes[n].value < lpm.header->label_count &&
+                               strcmp(cidrips_lpm_label(&lpm, prefixes[n].value), label) != 0)
+                        {
+                                prefixes[n].value++;
+                        }
+                        if (prefixes[n].value == lpm.header->label_count)
+                        {
+                                fprintf(stderr, "%s: label %s is not in table\n", argv[2], label);
+                                return EXIT_FAILURE;
+                        }
+                }
+                cidr = 32;
+                if (sscanf(s, "%u.%u.%u.%u/%u", &a, &b, &c, &d, &cidr) < 4 || cidr > 32)
+                {
+                        continue;
+                }
+                mask = cidr ? ~0U << (32 - cidr) : 0;
+                prefixes[n].first = (a << 24 | b << 16 | c << 8 | d) & mask;
+                prefixes[n].last = prefixes[n].first | ~mask;
+                prefixes[n].cidr = cidr;
+                n++;
+        }
+        fclose(f);
+        for (i = 0; ok && i < n; i++)
+        {
+                ok = check_addr(&lpm, prefixes, n, prefixes[i].first) &&
+                     check_addr(&lpm, prefixes, n, prefixes[i].last) &&
+                     check_addr(&lpm, prefixes, n, prefixes[i].first - 1) &&
+                     check_addr(&lpm, prefixes, n, prefixes[i].last + 1);
+        }
+        for (i = 0; ok && i < lookups; i++)
+        {
+                // half of addresses near subnets, else little is covered
+                ok = check_addr(&lpm, prefixes, n,
+                                i % 2 && n ? prefixes[check_rand(&x) % n].first + (uint32_t)(check_rand(&x) % 1024)
+                                           : (uint32_t)check_rand(&x));
+        }
+        printf("%zu subnets, %u ranges, %zu lookups: %s\n", n, lpm.header->range_count, lookups,
+               ok ? "ok" : "failed");
+        free(prefixes);
+        free(data);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
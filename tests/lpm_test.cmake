@@ -0,0 +1,21 @@
+# Write lpm-table and text output of cidrips on INPUT with ARGS (separated
+# by |) and cross-check table lookups with the text subnets (CHECK).
+string(REPLACE "|" ";" args "${ARGS}")
+set(table ${WORK_DIR}/${NAME}.lpm)
+set(subnets ${WORK_DIR}/${NAME}.txt)
+file(REMOVE ${table} ${subnets})
+execute_process(COMMAND ${CIDRIPS} -i ${INPUT} -o ${table} -s --output-format=lpm-table ${args}
+                RESULT_VARIABLE rc)
+if (NOT rc EQUAL 0)
+  message(FATAL_ERROR "cidrips failed: ${rc}")
+endif()
+execute_process(COMMAND ${CIDRIPS} -i ${INPUT} -o ${subnets} -s ${args}
+                RESULT_VARIABLE rc)
+if (NOT rc EQUAL 0)
+  message(FATAL_ERROR "cidrips failed: ${rc}")
+endif()
+execute_process(COMMAND ${CHECK} ${table} ${subnets}
+                RESULT_VARIABLE rc)
+if (NOT rc EQUAL 0)
+  message(FATAL_ERROR "lookups of ${table} differ from ${subnets}")
+endif()
@@ -0,0 +1,58 @@
+/*
+ * --max-memory collapse: every other address of 10.0.0.0/12 is twice as
+ * many subnets as the smallest limit allows. No /24 is full, so level 0
+ * cannot collapse anything, the set must be collapsed into /24 at level 1
+ * and never outgrow the limit. Internal functions are reached by including
+ * cidrips.c built without main().
+ *
+ *      test_set_limit FILE
+ *
+ * FILE is written by the test and parsed by load_input().
+ */
+#include "../cidrips.c"
+
+int main(int argc, char **argv)
+{
+        set_limit_t limit;
+        dedup_t dedup = {0};
+        addr_set_t set = {0};
+        ingest_opts_t opts = {(void *)0, 0, &limit, 0, -1, &dedup, (void *)0};
+        char err[512];
+        FILE *f;
+        uint32_t a;
+        size_t i, hosts = 0;
+        int ok;
+        if (argc < 2 || !(f = fopen(argv[1], "w")))
+        {
+                fprintf(stderr, "usage: test_set_limit FILE\n");
+                return EXIT_FAILURE;
+        }
+        for (a = 0x0a000000; a < 0x0a100000; a += 2)
+        {
+                fprintf(f, "%u.%u.%u.%u\n", a >> 24, (a >> 16) & 255, (a >> 8) & 255, a & 255);
+        }
+        if (fclose(f) != 0)
+        {
+                fprintf(stderr, "cannot write %s\n", argv[1]);
+                return EXIT_FAILURE;
+        }
+        set_limit_init(&limit, SET_LIMIT_MIN_MEMORY, 0);
+        ok = load_input(argv[1], &set, &opts, err, sizeof(err));
+        if (!ok)
+        {
+                fprintf(stderr, "%s\n", err);
+        }
+        for (i = 0; ok && i < set.len; i++)
+        {
+                // tail after the last collapse is left as parsed
+                hosts += set.items[i].addr.cidr == 32;
+                ok = set.items[i].addr.cidr == 32 || (set.items[i].addr.cidr == 24 && set.items[i].count == 128);
+        }
+        printf("limit %zu, %zu subnets (%zu hosts), %zu collapses to /%d at level %d\n", limit.max_len, set.len,
+               hosts, limit.collapses, limit.cidr, limit.used_level);
+        ok = ok && set.len <= limit.max_len && limit.collapses > 0 && limit.cidr == 24 && limit.used_level == 1 &&
+             limit.max_len >= SET_LIMIT_MIN_LEN;
+        set_free(&set);
+        dedup_free(&dedup);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}